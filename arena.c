@@ -0,0 +1,205 @@
+#include "arena.h"
+#include <gmp.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// size classes are 16 bytes, 32 bytes, ..., 1 MiB; anything larger goes straight to malloc
+#define MIN_SHIFT   4
+#define CLASSES     17
+#define LARGE       CLASSES
+#define CHUNK_BYTES (1024 * 1024 + HEADER)
+
+// every buffer carved from a chunk is preceded by a header naming its class
+typedef struct {
+    uint64_t cls;
+    uint64_t pad;
+} header_t;
+
+#define HEADER sizeof(header_t)
+
+typedef struct chunk {
+    struct chunk *next;
+    uint64_t pad;
+} chunk_t;
+
+typedef struct {
+    void *free_list[CLASSES];
+    chunk_t *chunks;
+    uint8_t *bump;
+    uint8_t *limit;
+    arena_stats_t stats;
+} arena_t;
+
+static _Thread_local arena_t arena;
+static bool arena_secure = false;
+
+// counters handed in by arena_reset() from every thread, and chunks held by all of them
+static arena_stats_t retired;
+static pthread_mutex_t retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t chunks_held = 0;
+
+// zero memory in a way the compiler may not optimize away
+static void secure_zero(void *ptr, size_t size) {
+    volatile uint8_t *p = (volatile uint8_t *) ptr;
+    while (size--) {
+        *p++ = 0;
+    }
+}
+
+// smallest class whose buffers hold size bytes
+static uint32_t size_class(size_t size) {
+    uint32_t cls = 0;
+    while (cls < CLASSES && ((size_t) 1 << (cls + MIN_SHIFT)) < size) {
+        cls += 1;
+    }
+    return cls;
+}
+
+static size_t class_bytes(uint32_t cls) {
+    return (size_t) 1 << (cls + MIN_SHIFT);
+}
+
+// whether ptr was carved from one of this thread's chunks; only then does it have a
+// header in front of it (large buffers, and memory GMP had before arena_install(), do not)
+static bool owned(const void *ptr) {
+    uintptr_t p = (uintptr_t) ptr;
+    for (chunk_t *c = arena.chunks; c != NULL; c = c->next) {
+        uintptr_t start = (uintptr_t) (c + 1);
+        if (p > start && p < start + CHUNK_BYTES) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *arena_alloc(size_t size) {
+    arena.stats.allocs += 1;
+    uint32_t cls = size_class(size);
+    if (cls == LARGE) {
+        arena.stats.heap_calls += 1;
+        void *ptr = malloc(size);
+        if (ptr == NULL) {
+            abort();
+        }
+        return ptr;
+    }
+    header_t *h;
+    if (arena.free_list[cls] != NULL) {
+        // reuse a released buffer of the same class
+        h = (header_t *) arena.free_list[cls];
+        arena.free_list[cls] = *(void **) h;
+    } else {
+        size_t need = HEADER + class_bytes(cls);
+        if (arena.bump == NULL || (size_t) (arena.limit - arena.bump) < need) {
+            // carve buffers out of a fresh chunk
+            arena.stats.heap_calls += 1;
+            arena.stats.chunks += 1;
+            __atomic_fetch_add(&chunks_held, 1, __ATOMIC_RELAXED);
+            chunk_t *c = (chunk_t *) malloc(sizeof(chunk_t) + CHUNK_BYTES);
+            if (c == NULL) {
+                abort();
+            }
+            c->next = arena.chunks;
+            arena.chunks = c;
+            arena.bump = (uint8_t *) (c + 1);
+            arena.limit = arena.bump + CHUNK_BYTES;
+        }
+        h = (header_t *) arena.bump;
+        arena.bump += need;
+    }
+    h->cls = cls;
+    return h + 1;
+}
+
+static void arena_free(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    arena.stats.frees += 1;
+    if (arena_secure) {
+        secure_zero(ptr, size);
+    }
+    if (!owned(ptr)) {
+        // a large buffer, or one allocated by malloc before the pool was installed
+        arena.stats.heap_calls += 1;
+        free(ptr);
+        return;
+    }
+    // the free list link overwrites the header
+    header_t *h = (header_t *) ptr - 1;
+    uint32_t cls = (uint32_t) h->cls;
+    *(void **) h = arena.free_list[cls];
+    arena.free_list[cls] = h;
+}
+
+static void *arena_realloc(void *ptr, size_t old_size, size_t new_size) {
+    bool pooled = (ptr != NULL && owned(ptr));
+    if (pooled && new_size <= class_bytes((uint32_t) ((header_t *) ptr - 1)->cls)) {
+        // the buffer's class already has room
+        arena.stats.in_place += 1;
+        if (arena_secure && new_size < old_size) {
+            secure_zero((uint8_t *) ptr + new_size, old_size - new_size);
+        }
+        return ptr;
+    }
+    void *fresh = arena_alloc(new_size);
+    if (ptr != NULL) {
+        memcpy(fresh, ptr, old_size < new_size ? old_size : new_size);
+        arena_free(ptr, old_size);
+    }
+    return fresh;
+}
+
+void arena_install(bool secure) {
+    arena_secure = secure;
+    mp_set_memory_functions(arena_alloc, arena_realloc, arena_free);
+}
+
+void arena_reset(void) {
+    while (arena.chunks != NULL) {
+        chunk_t *c = arena.chunks;
+        arena.chunks = c->next;
+        if (arena_secure) {
+            secure_zero(c + 1, CHUNK_BYTES);
+        }
+        free(c);
+        arena.stats.heap_calls += 1;
+    }
+    memset(arena.free_list, 0, sizeof(arena.free_list));
+    arena.bump = NULL;
+    arena.limit = NULL;
+    __atomic_fetch_sub(&chunks_held, arena.stats.chunks, __ATOMIC_RELAXED);
+    arena.stats.chunks = 0;
+    // hand this thread's counters in, so they are still counted after it exits
+    pthread_mutex_lock(&retired_lock);
+    retired.allocs += arena.stats.allocs;
+    retired.frees += arena.stats.frees;
+    retired.in_place += arena.stats.in_place;
+    retired.heap_calls += arena.stats.heap_calls;
+    pthread_mutex_unlock(&retired_lock);
+    memset(&arena.stats, 0, sizeof(arena.stats));
+}
+
+void arena_stats(arena_stats_t *stats) {
+    pthread_mutex_lock(&retired_lock);
+    stats->allocs = retired.allocs + arena.stats.allocs;
+    stats->frees = retired.frees + arena.stats.frees;
+    stats->in_place = retired.in_place + arena.stats.in_place;
+    stats->heap_calls = retired.heap_calls + arena.stats.heap_calls;
+    pthread_mutex_unlock(&retired_lock);
+    stats->chunks = __atomic_load_n(&chunks_held, __ATOMIC_RELAXED);
+}
+
+void arena_print_stats(FILE *outfile) {
+    arena_stats_t stats;
+    arena_stats(&stats);
+    fprintf(outfile,
+        "arena: %" PRIu64 " allocs, %" PRIu64 " frees, %" PRIu64 " in place, %" PRIu64
+        " heap calls, %" PRIu64 " chunks\n",
+        stats.allocs, stats.frees, stats.in_place, stats.heap_calls, stats.chunks);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Pooled allocator for GMP limb buffers.
+//
+// Once installed, every GMP allocation is served from a per-thread pool of
+// power of two size classes carved out of large chunks. Freed buffers go
+// back on their class's free list, so a steady state loop that keeps
+// creating and clearing mpz_t values of similar sizes makes no heap calls.
+//
+// Each thread owns the GMP values it creates: a value must be cleared by
+// the thread that allocated it. A buffer is known to be pooled by lying in
+// one of that thread's chunks; anything else (buffers over 1 MiB, and values
+// created before arena_install()) is handed to free().
+//
+
+typedef struct {
+    uint64_t allocs; // allocate and growing reallocate requests from GMP
+    uint64_t frees; // free requests from GMP
+    uint64_t in_place; // reallocate requests served without moving
+    uint64_t heap_calls; // malloc/free calls made by the pool itself
+    uint64_t chunks; // chunks currently held by the pools of all threads
+} arena_stats_t;
+
+//
+// Installs the pool as GMP's memory functions for all threads.
+// Must be called before any mpz_t is initialized.
+//
+// secure: zero buffers when they are released (for private key material)
+//
+void arena_install(bool secure);
+
+//
+// Releases every chunk held by the calling thread's pool, and adds its
+// counters to the totals arena_stats() reports. Call between batches, and
+// before a worker thread exits, once the thread has cleared all of its mpz_t values.
+//
+void arena_reset(void);
+
+//
+// Copies the allocation counters into stats: the calling thread's, plus
+// those handed in by arena_reset() from every thread, so a batch or
+// multi-recipient run reports the work of all of its workers.
+//
+void arena_stats(arena_stats_t *stats);
+
+//
+// Prints the counters arena_stats() reports to outfile.
+//
+void arena_print_stats(FILE *outfile);
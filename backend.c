@@ -0,0 +1,199 @@
+#include "backend.h"
+#include "numtheory.h"
+#include <gmp.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// GMP's general purpose powm
+static void gmp_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_powm(o, a, d, n);
+}
+
+// GMP's side channel silent powm
+static void sec_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mpz_powm_sec(o, a, d, n);
+}
+
+// numtheory's Montgomery engines, converting in and out of the domain
+static void mont_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n, bool window) {
+    mont_ctx ctx;
+    mpz_t x, y;
+    mpz_inits(x, y, NULL);
+    mont_init(&ctx, n);
+    mpz_mod(y, a, n);
+    mont_to(x, y, &ctx);
+    if (window) {
+        mont_pow_window(y, x, d, &ctx);
+    } else {
+        mont_pow(y, x, d, &ctx);
+    }
+    mont_from(o, y, &ctx);
+    mont_clear(&ctx);
+    mpz_clears(x, y, NULL);
+}
+
+static void binary_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mont_pow_mod(o, a, d, n, false);
+}
+
+static void window_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    mont_pow_mod(o, a, d, n, true);
+}
+
+const backend_t backends[] = {
+    { "ladder", pow_mod, false },
+    { "gmp", gmp_pow_mod, false },
+    { "gmp-sec", sec_pow_mod, true },
+    { "mont", binary_pow_mod, false },
+    { "mont-window", window_pow_mod, false },
+};
+
+// the default for private exponents
+#define SECRET_DEFAULT (&backends[2])
+
+const size_t backend_count = sizeof(backends) / sizeof(backends[0]);
+
+#define MAX_TUNED 64
+
+// tuned (modulus bits, backend) pairs, for public exponents and (secret) private ones
+static struct {
+    uint64_t bits;
+    bool secret;
+    const backend_t *backend;
+} tuned[MAX_TUNED];
+static size_t tuned_count = 0;
+
+// set once any tuning is loaded or set, so the first lookup knows not to load the default file
+static bool tuning_loaded = false;
+static pthread_once_t default_once = PTHREAD_ONCE_INIT;
+
+static void load_default(void) {
+    if (!__atomic_load_n(&tuning_loaded, __ATOMIC_ACQUIRE)) {
+        backend_load(NULL);
+    }
+}
+
+const backend_t *backend_find(const char *name) {
+    for (size_t i = 0; i < backend_count; i++) {
+        if (strcmp(backends[i].name, name) == 0) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+static const backend_t *lookup(uint64_t bits, bool secret) {
+    // library users get the tuning file too, without calling backend_load() themselves
+    pthread_once(&default_once, load_default);
+    const backend_t *best = secret ? SECRET_DEFAULT : &backends[0];
+    uint64_t best_dist = UINT64_MAX;
+    for (size_t i = 0; i < tuned_count; i++) {
+        if (tuned[i].secret != secret) {
+            continue;
+        }
+        uint64_t dist = tuned[i].bits > bits ? tuned[i].bits - bits : bits - tuned[i].bits;
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = tuned[i].backend;
+        }
+    }
+    return best;
+}
+
+const backend_t *backend_for(uint64_t bits) {
+    return lookup(bits, false);
+}
+
+const backend_t *backend_for_secret(uint64_t bits) {
+    return lookup(bits, true);
+}
+
+static bool set(uint64_t bits, bool secret, const backend_t *backend) {
+    if (secret && !backend->constant_time) {
+        return false;
+    }
+    __atomic_store_n(&tuning_loaded, true, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < tuned_count; i++) {
+        if (tuned[i].bits == bits && tuned[i].secret == secret) {
+            tuned[i].backend = backend;
+            return true;
+        }
+    }
+    if (tuned_count < MAX_TUNED) {
+        tuned[tuned_count].bits = bits;
+        tuned[tuned_count].secret = secret;
+        tuned[tuned_count].backend = backend;
+        tuned_count += 1;
+    }
+    return true;
+}
+
+void backend_set(uint64_t bits, const backend_t *backend) {
+    set(bits, false, backend);
+}
+
+bool backend_set_secret(uint64_t bits, const backend_t *backend) {
+    return set(bits, true, backend);
+}
+
+bool backend_load(const char *path) {
+    if (path == NULL) {
+        path = getenv("SS_TUNE");
+    }
+    if (path == NULL) {
+        path = BACKEND_TUNE_FILE;
+    }
+    FILE *tunefile = fopen(path, "r");
+    if (tunefile == NULL) {
+        return false;
+    }
+    tuned_count = 0;
+    __atomic_store_n(&tuning_loaded, true, __ATOMIC_RELEASE);
+    char line[256];
+    while (fgets(line, sizeof(line), tunefile) != NULL) {
+        // lines are "bits backend" or "bits backend secret", '#' starts a comment
+        uint64_t bits;
+        char name[64], use[16] = "";
+        if (line[0] == '#' || sscanf(line, "%" SCNu64 " %63s %15s", &bits, name, use) < 2) {
+            continue;
+        }
+        const backend_t *backend = backend_find(name);
+        if (backend != NULL) {
+            // a private exponent entry naming a backend that is not constant time is ignored
+            set(bits, strcmp(use, "secret") == 0, backend);
+        }
+    }
+    fclose(tunefile);
+    return true;
+}
+
+void backend_save(FILE *outfile) {
+    fprintf(outfile, "# modulus bits, modexp backend, secret for private exponents\n");
+    for (size_t i = 0; i < tuned_count; i++) {
+        fprintf(outfile, "%" PRIu64 " %s%s\n", tuned[i].bits, tuned[i].backend->name,
+            tuned[i].secret ? " secret" : "");
+    }
+}
+
+void backend_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    const backend_t *backend = backend_for(mpz_sizeinbase(n, 2));
+    if (mpz_even_p(n) || mpz_sgn(d) <= 0) {
+        // only the ladder handles every input
+        backend = &backends[0];
+    }
+    backend->pow_mod(o, a, d, n);
+}
+
+void backend_pow_mod_secret(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
+    const backend_t *backend = backend_for_secret(mpz_sizeinbase(n, 2));
+    if (mpz_even_p(n) || mpz_sgn(d) <= 0) {
+        // only the ladder handles every input; a private key never gets here
+        backend = &backends[0];
+    }
+    backend->pow_mod(o, a, d, n);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Default tuning file, overridden by the SS_TUNE environment variable
+#define BACKEND_TUNE_FILE "ss.tune"
+
+//
+// A modular exponentiation engine: o = a^d mod n.
+// Every backend accepts any a >= 0, d > 0 and odd n > 1.
+//
+// Only constant time backends (whose timing and memory access do not depend
+// on the bits of d) are used with private exponents; the others would leak d
+// through a timing side channel.
+//
+typedef struct {
+    const char *name;
+    void (*pow_mod)(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
+    bool constant_time;
+} backend_t;
+
+// All backends, the first being the default (numtheory's pow_mod)
+extern const backend_t backends[];
+extern const size_t backend_count;
+
+//
+// Finds a backend by name, returning NULL if there is none.
+//
+const backend_t *backend_find(const char *name);
+
+//
+// Returns the backend tuned for public exponents and moduli of the given
+// bit length: the entry with the nearest size in the loaded tuning, or the
+// default if none.
+//
+// Unless backend_load() or backend_set() was called first, the first lookup
+// loads the default tuning file (as backend_load(NULL) does), so library
+// users are tuned the same way the encrypt and decrypt programs are.
+//
+const backend_t *backend_for(uint64_t bits);
+
+//
+// As backend_for(), for private exponents: only constant time backends are
+// ever returned, gmp-sec being the default.
+//
+const backend_t *backend_for_secret(uint64_t bits);
+
+//
+// Records that public exponents with moduli of the given bit length should use backend.
+//
+void backend_set(uint64_t bits, const backend_t *backend);
+
+//
+// Records that private exponents with moduli of the given bit length should use backend.
+//
+// Provides:
+//  returns false, recording nothing, if backend is not constant time
+//
+bool backend_set_secret(uint64_t bits, const backend_t *backend);
+
+//
+// Loads a tuning file written by the tune program, replacing any loaded
+// tuning. A NULL path means $SS_TUNE, or BACKEND_TUNE_FILE if unset.
+// Private exponent entries that name a backend that is not constant time
+// are ignored.
+//
+// Provides:
+//  returns false if the file could not be opened
+//
+bool backend_load(const char *path);
+
+//
+// Writes the current tuning to outfile in the format backend_load() reads.
+//
+void backend_save(FILE *outfile);
+
+//
+// o = a^d mod n using the backend tuned for n's size, for a public exponent d.
+//
+void backend_pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
+
+//
+// o = a^d mod n using the constant time backend tuned for n's size, for a
+// private exponent d.
+//
+void backend_pow_mod_secret(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
@@ -0,0 +1,303 @@
+#include "batch.h"
+#include "arena.h"
+#include "blockcache.h"
+#include "ss.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// what every worker shares: the key, the options and the next file to take
+typedef struct {
+    char **paths;
+    char **outs; // output path for each input, NULL for one that is skipped or failed up front
+    uint64_t count;
+    uint64_t next; // index of the next unclaimed path
+    uint64_t failed;
+    bool encrypt;
+    mpz_srcptr n, d, pq;
+    uint64_t block;
+    const batch_opts_t *opts;
+} batch_t;
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t ls = strlen(s), lx = strlen(suffix);
+    return lx <= ls && strcmp(s + ls - lx, suffix) == 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static void list_push(char ***paths, uint64_t *count, uint64_t *cap, char *path) {
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        *paths = (char **) realloc(*paths, *cap * sizeof(char *));
+    }
+    (*paths)[(*count)++] = path;
+}
+
+void batch_list_stream(FILE *infile, char ***paths, uint64_t *count) {
+    uint64_t cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    *paths = NULL;
+    *count = 0;
+    while ((len = getline(&line, &line_cap, infile)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+        if (len > 0) {
+            list_push(paths, count, &cap, strdup(line));
+        }
+    }
+    free(line);
+}
+
+bool batch_list_dir(const char *dir, const char *suffix, char ***paths, uint64_t *count) {
+    uint64_t cap = 0;
+    *paths = NULL;
+    *count = 0;
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != NULL) {
+        if (suffix != NULL && !ends_with(entry->d_name, suffix)) {
+            continue;
+        }
+        size_t len = strlen(dir) + strlen(entry->d_name) + 2;
+        char *path = (char *) malloc(len);
+        snprintf(path, len, "%s/%s", dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        list_push(paths, count, &cap, path);
+    }
+    closedir(dp);
+    qsort(*paths, *count, sizeof(char *), compare_paths);
+    return true;
+}
+
+void batch_free_list(char **paths, uint64_t count) {
+    for (uint64_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+// where the output for path goes: in outdir if given, with the suffix added or removed
+static char *output_path(const char *path, bool encrypt, const batch_opts_t *opts) {
+    const char *name = path;
+    if (opts->outdir != NULL) {
+        const char *slash = strrchr(path, '/');
+        name = slash ? slash + 1 : path;
+    }
+    size_t base = strlen(name);
+    const char *add = opts->suffix;
+    if (!encrypt) {
+        if (ends_with(name, opts->suffix) && base > strlen(opts->suffix)) {
+            base -= strlen(opts->suffix);
+            add = "";
+        } else {
+            add = ".dec";
+        }
+    }
+    size_t len = (opts->outdir ? strlen(opts->outdir) + 1 : 0) + base + strlen(add) + 1;
+    char *out = (char *) malloc(len);
+    snprintf(out, len, "%s%s%.*s%s", opts->outdir ? opts->outdir : "", opts->outdir ? "/" : "",
+        (int) base, name, add);
+    return out;
+}
+
+// process one file, reporting any failure on stderr
+static bool batch_one(batch_t *batch, const char *path, const char *out_path, blockcache_t *cache) {
+    FILE *infile = fopen(path, "r");
+    if (infile == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return false;
+    }
+    FILE *outfile = fopen(out_path, "w");
+    if (outfile == NULL) {
+        fprintf(stderr, "%s: %s\n", out_path, strerror(errno));
+        fclose(infile);
+        return false;
+    }
+    // compressed data goes through a codec stream: read compressed when encrypting,
+    // written through decompression when decrypting
+    codec_t codec = batch->opts->codec;
+    FILE *plain = NULL;
+    bool ok = batch->encrypt || codec_read_header(infile, &codec);
+    if (ok && codec != CODEC_NONE) {
+        if (batch->encrypt) {
+            codec_write_header(outfile, codec);
+            plain = codec_compress_reader(infile, codec);
+        } else {
+            plain = codec_decompress_writer(outfile, codec);
+        }
+        ok = (plain != NULL);
+    }
+    if (ok) {
+        ok = batch->encrypt ? ss_encrypt_file_cached(plain ? plain : infile, outfile, batch->n,
+                                  batch->block, cache)
+                            : ss_decrypt_file_cached(
+                                  infile, plain ? plain : outfile, batch->d, batch->pq, cache);
+    }
+    if (plain != NULL) {
+        ok = (fclose(plain) == 0) && ok;
+    }
+    fclose(infile);
+    ok = (fclose(outfile) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "%s: %s failed\n", path, batch->encrypt ? "encryption" : "decryption");
+        remove(out_path);
+    } else if (batch->opts->verbose) {
+        fprintf(stderr, "%s -> %s\n", path, out_path);
+    }
+    return ok;
+}
+
+// a path in the batch, as an input or as the output of paths[index]
+typedef struct {
+    const char *path;
+    uint64_t index;
+    bool output;
+} name_t;
+
+static int compare_names(const void *a, const void *b) {
+    const name_t *x = (const name_t *) a, *y = (const name_t *) b;
+    int c = strcmp(x->path, y->path);
+    return c != 0 ? c : (int) x->output - (int) y->output;
+}
+
+//
+// Work out every output path before any worker starts, so that no file is
+// written twice or written while it is being read: a file whose output is
+// shared with another output (a/x and b/x with -O) or with another input
+// fails up front. Encryption skips inputs that already carry the suffix,
+// such as the outputs of an earlier run over the same directory.
+//
+static void batch_plan(batch_t *batch) {
+    const batch_opts_t *opts = batch->opts;
+    batch->outs = (char **) calloc(batch->count, sizeof(char *));
+    name_t *names = (name_t *) calloc(2 * batch->count, sizeof(name_t));
+    uint64_t named = 0;
+    for (uint64_t i = 0; i < batch->count; i++) {
+        const char *path = batch->paths[i];
+        if (batch->encrypt && ends_with(path, opts->suffix)) {
+            fprintf(stderr, "%s: already ends in %s, skipped\n", path, opts->suffix);
+            continue;
+        }
+        names[named++] = (name_t) { path, i, false };
+        char *out = output_path(path, batch->encrypt, opts);
+        if (strcmp(out, path) == 0) {
+            fprintf(stderr, "%s: output would overwrite the input\n", path);
+            free(out);
+            batch->failed += 1;
+            continue;
+        }
+        batch->outs[i] = out;
+        names[named++] = (name_t) { out, i, true };
+    }
+    qsort(names, named, sizeof(name_t), compare_names);
+    for (uint64_t i = 0; i < named;) {
+        uint64_t j = i + 1;
+        while (j < named && strcmp(names[i].path, names[j].path) == 0) {
+            j += 1;
+        }
+        // a run of equal paths is a clash if it holds an output and anything else
+        for (uint64_t e = i; e < j && j - i > 1; e++) {
+            uint64_t index = names[e].index;
+            if (names[e].output && batch->outs[index] != NULL) {
+                fprintf(stderr, "%s: output %s clashes with another file in the batch\n",
+                    batch->paths[index], names[e].path);
+                free(batch->outs[index]);
+                batch->outs[index] = NULL;
+                batch->failed += 1;
+            }
+        }
+        i = j;
+    }
+    free(names);
+}
+
+static void *batch_worker(void *arg) {
+    batch_t *batch = (batch_t *) arg;
+    // caches are not shared between threads
+    blockcache_t *cache = blockcache_create(batch->opts->cache_entries);
+    uint64_t i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count) {
+        if (batch->outs[i] == NULL) {
+            continue;
+        }
+        if (!batch_one(batch, batch->paths[i], batch->outs[i], cache)) {
+            __atomic_fetch_add(&batch->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (cache != NULL) {
+        blockcache_delete(&cache);
+    }
+    return NULL;
+}
+
+static void *batch_thread(void *arg) {
+    batch_worker(arg);
+    // hand back this thread's pooled chunks, if the pooled allocator is in use; the
+    // caller's thread keeps its own, as they hold the key
+    arena_reset();
+    return NULL;
+}
+
+static uint64_t batch_run(batch_t *batch) {
+    if (batch->count == 0) {
+        return 0;
+    }
+    batch_plan(batch);
+    uint64_t threads = batch->opts->threads;
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint64_t) cpus : 1;
+    }
+    if (threads > batch->count) {
+        threads = batch->count;
+    }
+    pthread_t *workers = (pthread_t *) calloc(threads, sizeof(pthread_t));
+    uint64_t started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, batch_thread, batch) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        // no threads to be had, do the work here
+        batch_worker(batch);
+    }
+    for (uint64_t i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    for (uint64_t i = 0; i < batch->count; i++) {
+        free(batch->outs[i]);
+    }
+    free(batch->outs);
+    return batch->failed;
+}
+
+uint64_t batch_encrypt(
+    char **paths, uint64_t count, const mpz_t n, uint64_t block, const batch_opts_t *opts) {
+    batch_t batch = { paths, NULL, count, 0, 0, true, n, NULL, NULL, block, opts };
+    return batch_run(&batch);
+}
+
+uint64_t batch_decrypt(
+    char **paths, uint64_t count, const mpz_t d, const mpz_t pq, const batch_opts_t *opts) {
+    batch_t batch = { paths, NULL, count, 0, 0, false, NULL, d, pq, 0, opts };
+    return batch_run(&batch);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+#include "codec.h"
+
+//
+// Batch encryption and decryption of many files with one key.
+//
+// The key is read and set up once by the caller; a pool of worker threads
+// then takes files off a shared list, each worker with its own buffers and
+// block cache. A file that cannot be read, written or decrypted is reported
+// on stderr and its partial output removed, without stopping the others.
+//
+// Every output path is worked out first. Files whose outputs would clash,
+// with each other (a/x and b/x written to one outdir) or with another input,
+// fail without being touched, and encryption skips inputs that already end
+// in the suffix, so rerunning over a directory does not encrypt its outputs.
+//
+
+typedef struct {
+    const char *outdir; // directory for the outputs, or NULL to write next to each input
+    const char *suffix; // appended by encrypt, removed by decrypt (".dec" is added if absent)
+    uint64_t threads; // worker threads, or 0 for one per online CPU
+    uint64_t cache_entries; // per worker block cache capacity, or 0 for none
+    bool verbose; // print each input and output path to stderr
+    codec_t codec; // encrypt: compress each file first; decrypt follows each file's header
+} batch_opts_t;
+
+//
+// Reads a list of paths, one per line, skipping empty lines.
+//
+// Provides:
+//  paths: newly allocated list, freed by batch_free_list()
+//  count: number of paths
+//
+// Requires:
+//  infile: open and readable file stream
+//
+void batch_list_stream(FILE *infile, char ***paths, uint64_t *count);
+
+//
+// Lists the regular files directly inside a directory, sorted by name.
+//
+// Provides:
+//  paths: newly allocated list of dir/name paths, freed by batch_free_list()
+//  count: number of paths
+//
+// Requires:
+//  dir: directory to list
+//  suffix: only list names ending in suffix, or NULL for every file
+//
+// Returns false if the directory could not be opened.
+//
+bool batch_list_dir(const char *dir, const char *suffix, char ***paths, uint64_t *count);
+
+//
+// Frees a list from batch_list_stream() or batch_list_dir().
+//
+void batch_free_list(char **paths, uint64_t count);
+
+//
+// Encrypts every file in paths.
+//
+// Requires:
+//  n: public exponent and modulus, only read by the workers
+//  block: block size recorded in the public key, or 0
+//
+// Returns the number of files that failed.
+//
+uint64_t batch_encrypt(
+    char **paths, uint64_t count, const mpz_t n, uint64_t block, const batch_opts_t *opts);
+
+//
+// Decrypts every file in paths.
+//
+// Requires:
+//  d: private exponent, only read by the workers
+//  pq: private modulus, only read by the workers
+//
+// Returns the number of files that failed.
+//
+uint64_t batch_decrypt(
+    char **paths, uint64_t count, const mpz_t d, const mpz_t pq, const batch_opts_t *opts);
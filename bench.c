@@ -0,0 +1,516 @@
+#define _GNU_SOURCE // nftw
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#define OPTIONS "b:s:j:o:c:r:d:x:kvh"
+
+#define CHUNK       (1 << 20)
+#define BATCH_PARTS 16 // files a corpus is split into for the batch runs
+#define MAX_ROWS    4096
+#define MAX_ARGS    64
+#define MIN_SECONDS 0.05 // shortest baseline run compared
+
+void h_option(void);
+
+void usage(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Runs keygen, encrypt and decrypt end to end over synthetic corpora,\n"
+        "   checks every round trip and reports throughput, peak RSS and CPU use.\n"
+        "\n"
+        "USAGE\n"
+        "   %s [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h             Display program help and usage.\n"
+        "   -v             Print each run as it finishes.\n"
+        "   -b bits        Largest key size, from 256 doubling (default: 1024).\n"
+        "   -s size        Largest corpus, from 1K growing 8x; K, M, G suffixes (default: 64K).\n"
+        "   -j threads     Largest batch mode thread count, from 2 doubling (default: 1, no batch runs).\n"
+        "   -x flags       Extra flags for encrypt, such as \"-z\" (default: none).\n"
+        "   -o report      Write report.csv and report.json (default: perf).\n"
+        "   -c baseline    Compare against an earlier report's csv file.\n"
+        "   -r percent     Slowdown against the baseline that counts as a regression (default: 10).\n"
+        "   -d dir         Make the scratch directory in dir (default: .).\n"
+        "   -k             Keep the scratch directory.\n",
+        exec);
+}
+
+typedef struct {
+    char phase[16]; // keygen, encrypt or decrypt
+    char kind[16]; // corpus: random, zeros, text (or - for keygen)
+    uint64_t bytes; // plaintext bytes
+    uint64_t bits; // key size
+    uint64_t threads; // 1 for a single file run, otherwise batch mode threads
+    double seconds;
+    double mbps;
+    double cpu; // user + system time over wall time, in percent
+    uint64_t rss_kb; // peak resident set size
+    bool ok; // the run exited cleanly and the round trip matched
+} row_t;
+
+static row_t rows[MAX_ROWS];
+static size_t row_count = 0;
+static row_t base_rows[MAX_ROWS]; // the baseline report, read before this run's is written
+static size_t base_count = 0;
+static bool verbose_output = false;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t v = (uint64_t) strtoull(s, &end, 10);
+    switch (*end) {
+    case 'k':
+    case 'K': return v << 10;
+    case 'm':
+    case 'M': return v << 20;
+    case 'g':
+    case 'G': return v << 30;
+    default: return v;
+    }
+}
+
+// xorshift64*, fast enough to fill gigabytes
+static uint64_t rng = 0x9E3779B97F4A7C15ull;
+static uint64_t next_random(void) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545F4914F6CDD1Dull;
+}
+
+// fill buf with len bytes of the named corpus
+static void fill(uint8_t *buf, size_t len, const char *kind) {
+    static const char *words[] = { "GET", "POST", "/api/v1/items", "/health", "200", "404",
+        "user", "session", "latency_ms", "ok", "error", "request", "served", "cache", "miss",
+        "hit" };
+    if (strcmp(kind, "zeros") == 0) {
+        memset(buf, 0, len);
+    } else if (strcmp(kind, "random") == 0) {
+        for (size_t i = 0; i < len; i += 8) {
+            uint64_t r = next_random();
+            memcpy(buf + i, &r, (len - i < 8) ? len - i : 8);
+        }
+    } else {
+        // log-like text: words, numbers and newlines
+        size_t i = 0;
+        while (i < len) {
+            uint64_t r = next_random();
+            char word[32];
+            int n = (r & 3) == 0 ? snprintf(word, sizeof(word), "%" PRIu64 " ", (r >> 8) % 100000)
+                                 : snprintf(word, sizeof(word), "%s%s", words[(r >> 8) % 16],
+                                     (r >> 16) % 8 == 0 ? "\n" : " ");
+            size_t take = (len - i < (size_t) n) ? len - i : (size_t) n;
+            memcpy(buf + i, word, take);
+            i += take;
+        }
+    }
+}
+
+static bool make_corpus(const char *path, uint64_t bytes, const char *kind) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return false;
+    }
+    uint8_t *buf = (uint8_t *) malloc(CHUNK);
+    for (uint64_t done = 0; done < bytes;) {
+        size_t len = (bytes - done < CHUNK) ? bytes - done : CHUNK;
+        fill(buf, len, kind);
+        if (fwrite(buf, sizeof(uint8_t), len, f) != len) {
+            break;
+        }
+        done += len;
+    }
+    free(buf);
+    // a short corpus would still round trip, so it has to fail here
+    bool ok = !ferror(f);
+    return (fclose(f) == 0) && ok;
+}
+
+static bool same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    bool same = (fa != NULL && fb != NULL);
+    uint8_t *ba = (uint8_t *) malloc(CHUNK), *bb = (uint8_t *) malloc(CHUNK);
+    while (same) {
+        size_t na = fread(ba, 1, CHUNK, fa), nb = fread(bb, 1, CHUNK, fb);
+        same = (na == nb && memcmp(ba, bb, na) == 0);
+        if (na == 0) {
+            break;
+        }
+    }
+    if (fa != NULL) {
+        fclose(fa);
+    }
+    if (fb != NULL) {
+        fclose(fb);
+    }
+    free(ba);
+    free(bb);
+    return same;
+}
+
+// run argv to completion, filling in the timing and resource columns of row
+static bool run(char **argv, row_t *row) {
+    // children would otherwise inherit and flush our buffered output
+    fflush(NULL);
+    double start = now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        // the programs' own output is not part of the measurement
+        if (freopen("/dev/null", "w", stdout) == NULL) {
+            _exit(127);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        return false;
+    }
+    row->seconds = now() - start;
+    double cpu = (double) usage.ru_utime.tv_sec + (double) usage.ru_utime.tv_usec / 1e6
+                 + (double) usage.ru_stime.tv_sec + (double) usage.ru_stime.tv_usec / 1e6;
+    row->cpu = row->seconds > 0 ? 100 * cpu / row->seconds : 0;
+    row->rss_kb = (uint64_t) usage.ru_maxrss;
+    row->mbps = row->seconds > 0 ? (double) row->bytes / row->seconds / 1e6 : 0;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// argv for a program: its fixed arguments as given, then the space separated extras
+static void build_args(char **argv, char *storage, const char **fixed, const char *extra) {
+    size_t argc = 0;
+    for (; fixed[argc] != NULL && argc < MAX_ARGS - 1; argc++) {
+        argv[argc] = (char *) fixed[argc];
+    }
+    snprintf(storage, 4096, "%s", extra ? extra : "");
+    for (char *tok = strtok(storage, " "); tok != NULL && argc < MAX_ARGS - 1;
+         tok = strtok(NULL, " ")) {
+        argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void) st, (void) flag, (void) ftw;
+    return remove(path);
+}
+
+// delete the scratch directory and everything in it, without following symlinks
+static void remove_tree(const char *dir) {
+    if (nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS) != 0) {
+        printf("%s: unable to remove scratch directory\n", dir);
+    }
+}
+
+static row_t *add_row(
+    const char *phase, const char *kind, uint64_t bytes, uint64_t bits, uint64_t threads) {
+    if (row_count == MAX_ROWS) {
+        return NULL;
+    }
+    row_t *row = &rows[row_count++];
+    memset(row, 0, sizeof(*row));
+    snprintf(row->phase, sizeof(row->phase), "%s", phase);
+    snprintf(row->kind, sizeof(row->kind), "%s", kind);
+    row->bytes = bytes;
+    row->bits = bits;
+    row->threads = threads;
+    return row;
+}
+
+static void report_row(const row_t *row) {
+    if (verbose_output) {
+        printf("%-8s %-7s %12" PRIu64 " B %5" PRIu64 " bits %3" PRIu64
+               " thr %9.3f s %9.3f MB/s %6.1f%% cpu %8" PRIu64 " KB %s\n",
+            row->phase, row->kind, row->bytes, row->bits, row->threads, row->seconds, row->mbps,
+            row->cpu, row->rss_kb, row->ok ? "ok" : "FAILED");
+    }
+}
+
+// encrypt and decrypt one corpus with one key, in a single file or batch mode
+static void run_pair(const char *dir, const char *kind, uint64_t bytes, uint64_t bits,
+    uint64_t threads, const char *extra) {
+    char storage[4096], *argv[MAX_ARGS];
+    char pub[512], priv[512], plain[512], enc[512], dec[512], thr[24];
+    snprintf(pub, sizeof(pub), "%s/k%" PRIu64 ".pub", dir, bits);
+    snprintf(priv, sizeof(priv), "%s/k%" PRIu64 ".priv", dir, bits);
+    row_t *e = add_row("encrypt", kind, bytes, bits, threads);
+    row_t *d = add_row("decrypt", kind, bytes, bits, threads);
+    if (e == NULL || d == NULL) {
+        return;
+    }
+    if (threads == 1) {
+        snprintf(plain, sizeof(plain), "%s/corpus", dir);
+        snprintf(enc, sizeof(enc), "%s/corpus.enc", dir);
+        snprintf(dec, sizeof(dec), "%s/corpus.dec", dir);
+        const char *enc_args[] = { "./encrypt", "-n", pub, "-i", plain, "-o", enc, NULL };
+        build_args(argv, storage, enc_args, extra);
+        e->ok = run(argv, e);
+        const char *dec_args[] = { "./decrypt", "-n", priv, "-i", enc, "-o", dec, NULL };
+        build_args(argv, storage, dec_args, NULL);
+        d->ok = run(argv, d) && e->ok && same_file(plain, dec);
+    } else {
+        // the parts in dir/parts encrypt into dir/enc and decrypt into dir/dec
+        snprintf(plain, sizeof(plain), "%s/parts", dir);
+        snprintf(enc, sizeof(enc), "%s/enc", dir);
+        snprintf(dec, sizeof(dec), "%s/dec", dir);
+        snprintf(thr, sizeof(thr), "%" PRIu64, threads);
+        const char *enc_args[] = { "./encrypt", "-n", pub, "-D", plain, "-O", enc, "-j", thr, NULL };
+        build_args(argv, storage, enc_args, extra);
+        e->ok = run(argv, e);
+        const char *dec_args[] = { "./decrypt", "-n", priv, "-D", enc, "-O", dec, "-j", thr, NULL };
+        build_args(argv, storage, dec_args, NULL);
+        d->ok = run(argv, d) && e->ok;
+        for (int i = 0; i < BATCH_PARTS && d->ok; i++) {
+            snprintf(plain, sizeof(plain), "%s/parts/p%02d", dir, i);
+            snprintf(dec, sizeof(dec), "%s/dec/p%02d", dir, i);
+            d->ok = same_file(plain, dec);
+        }
+    }
+    report_row(e);
+    report_row(d);
+}
+
+// returns false, having said so, if either report could not be written
+static bool write_reports(const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s.csv", name);
+    FILE *csv = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.json", name);
+    FILE *json = fopen(path, "w");
+    if (csv == NULL || json == NULL) {
+        printf("%s: unable to open report files\n", name);
+        if (csv != NULL) {
+            fclose(csv);
+        }
+        if (json != NULL) {
+            fclose(json);
+        }
+        return false;
+    }
+    fprintf(csv, "phase,kind,bytes,bits,threads,seconds,mbps,cpu_pct,max_rss_kb,ok\n");
+    fprintf(json, "[\n");
+    for (size_t i = 0; i < row_count; i++) {
+        const row_t *r = &rows[i];
+        fprintf(csv, "%s,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f,%.3f,%.1f,%" PRIu64 ",%d\n",
+            r->phase, r->kind, r->bytes, r->bits, r->threads, r->seconds, r->mbps, r->cpu,
+            r->rss_kb, r->ok);
+        fprintf(json,
+            "  {\"phase\": \"%s\", \"kind\": \"%s\", \"bytes\": %" PRIu64 ", \"bits\": %" PRIu64
+            ", \"threads\": %" PRIu64 ", \"seconds\": %.6f, \"mbps\": %.3f, \"cpu_pct\": %.1f, "
+            "\"max_rss_kb\": %" PRIu64 ", \"ok\": %s}%s\n",
+            r->phase, r->kind, r->bytes, r->bits, r->threads, r->seconds, r->mbps, r->cpu,
+            r->rss_kb, r->ok ? "true" : "false", (i + 1 < row_count) ? "," : "");
+    }
+    fprintf(json, "]\n");
+    bool ok = !ferror(csv) && !ferror(json);
+    ok = (fclose(csv) == 0) && ok;
+    ok = (fclose(json) == 0) && ok;
+    if (!ok) {
+        printf("%s: unable to write report files\n", name);
+    }
+    return ok;
+}
+
+// read a baseline csv into base_rows; returns false if it could not be opened
+static bool load_baseline(const char *baseline) {
+    FILE *f = fopen(baseline, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL && base_count < MAX_ROWS) {
+        row_t *b = &base_rows[base_count];
+        int ok;
+        if (sscanf(line,
+                "%15[^,],%15[^,],%" SCNu64 ",%" SCNu64 ",%" SCNu64 ",%lf,%lf,%lf,%" SCNu64 ",%d",
+                b->phase, b->kind, &b->bytes, &b->bits, &b->threads, &b->seconds, &b->mbps,
+                &b->cpu, &b->rss_kb, &ok)
+            != 10) {
+            // the header, or a line from some other tool
+            continue;
+        }
+        b->ok = ok;
+        base_count += 1;
+    }
+    fclose(f);
+    return true;
+}
+
+// compare run times with the baseline; returns the number of regressions
+static uint64_t compare(double percent) {
+    uint64_t regressions = 0;
+    printf("%-8s %-7s %12s %5s %3s %10s %10s %8s\n", "phase", "kind", "bytes", "bits", "thr",
+        "base s", "now s", "change");
+    for (size_t j = 0; j < base_count; j++) {
+        const row_t b = base_rows[j];
+        for (size_t i = 0; i < row_count; i++) {
+            const row_t *r = &rows[i];
+            if (strcmp(r->phase, b.phase) != 0 || strcmp(r->kind, b.kind) != 0
+                || r->bytes != b.bytes || r->bits != b.bits || r->threads != b.threads) {
+                continue;
+            }
+            double change = b.seconds > 0 ? 100 * (r->seconds - b.seconds) / b.seconds : 0;
+            // a few milliseconds of start-up noise is not a regression
+            bool slower = change > percent && b.seconds >= MIN_SECONDS;
+            regressions += slower;
+            printf("%-8s %-7s %12" PRIu64 " %5" PRIu64 " %3" PRIu64 " %10.3f %10.3f %+7.1f%%%s\n",
+                r->phase, r->kind, r->bytes, r->bits, r->threads, b.seconds, r->seconds, change,
+                slower ? "  REGRESSION" : "");
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    uint64_t max_bits = 1024;
+    uint64_t max_bytes = 64 << 10;
+    uint64_t max_threads = 1;
+    char *report_name = "perf";
+    char *baseline = NULL;
+    double percent = 10;
+    char *parent = ".";
+    char *extra = NULL;
+    bool keep = false;
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': verbose_output = true; break;
+        case 'b': max_bits = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 's': max_bytes = parse_size(optarg); break;
+        case 'j': max_threads = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'o': report_name = optarg; break;
+        case 'c': baseline = optarg; break;
+        case 'r': percent = strtod(optarg, NULL); break;
+        case 'd': parent = optarg; break;
+        case 'x': extra = optarg; break;
+        case 'k': keep = true; break;
+        case 'h': h_option(); return 0;
+        default:
+            usage(argv[0]); /* Invalid options, show usage */
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the baseline may be the report this run is about to overwrite, so read it first
+    if (baseline != NULL && !load_baseline(baseline)) {
+        printf("%s: unable to open baseline\n", baseline);
+        return EXIT_FAILURE;
+    }
+
+    // a fresh private directory, so that removing it afterwards only removes our files
+    char dir[256], path[512], storage[4096], bits_arg[24], *args[MAX_ARGS];
+    if (strlen(parent) + strlen("/perf.XXXXXX") >= sizeof(dir)) {
+        printf("%s: scratch directory name too long\n", parent);
+        return EXIT_FAILURE;
+    }
+    snprintf(dir, sizeof(dir), "%s/perf.XXXXXX", parent);
+    if (mkdtemp(dir) == NULL) {
+        printf("%s: unable to create scratch directory\n", parent);
+        return EXIT_FAILURE;
+    }
+    const char *subdirs[] = { "parts", "enc", "dec" };
+    for (int i = 0; i < 3; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, subdirs[i]);
+        mkdir(path, 0700);
+    }
+
+    // one key per size, timing keygen on the way
+    for (uint64_t bits = 256; bits <= max_bits; bits *= 2) {
+        row_t *row = add_row("keygen", "-", 0, bits, 1);
+        char pub[512], priv[512];
+        snprintf(bits_arg, sizeof(bits_arg), "%" PRIu64, bits);
+        snprintf(pub, sizeof(pub), "%s/k%" PRIu64 ".pub", dir, bits);
+        snprintf(priv, sizeof(priv), "%s/k%" PRIu64 ".priv", dir, bits);
+        const char *keygen_args[] = { "./keygen", "-b", bits_arg, "-n", pub, "-d", priv, NULL };
+        build_args(args, storage, keygen_args, NULL);
+        row->ok = run(args, row);
+        report_row(row);
+    }
+
+    const char *kinds[] = { "random", "zeros", "text" };
+    bool corpora = true;
+    for (int k = 0; k < 3 && corpora; k++) {
+        for (uint64_t bytes = 1 << 10; bytes <= max_bytes && corpora; bytes *= 8) {
+            snprintf(path, sizeof(path), "%s/corpus", dir);
+            corpora = make_corpus(path, bytes, kinds[k]);
+            for (int i = 0; i < BATCH_PARTS && max_threads > 1 && corpora; i++) {
+                snprintf(path, sizeof(path), "%s/parts/p%02d", dir, i);
+                corpora = make_corpus(path, bytes / BATCH_PARTS, kinds[k]);
+            }
+            if (!corpora) {
+                printf("%s: unable to write corpus\n", path);
+                break;
+            }
+            for (uint64_t bits = 256; bits <= max_bits; bits *= 2) {
+                run_pair(dir, kinds[k], bytes, bits, 1, extra);
+                for (uint64_t threads = 2; threads <= max_threads; threads *= 2) {
+                    run_pair(dir, kinds[k], bytes, bits, threads, extra);
+                }
+            }
+        }
+    }
+
+    bool reported = write_reports(report_name);
+    uint64_t failures = 0;
+    for (size_t i = 0; i < row_count; i++) {
+        failures += !rows[i].ok;
+    }
+    if (reported) {
+        printf("perf: %zu runs, %" PRIu64 " failed, report in %s.csv and %s.json\n", row_count,
+            failures, report_name, report_name);
+    } else {
+        printf("perf: %zu runs, %" PRIu64 " failed, no report written\n", row_count, failures);
+    }
+    uint64_t regressions = baseline != NULL ? compare(percent) : 0;
+    if (baseline != NULL) {
+        printf("perf: %" PRIu64 " regressions past %.0f%%\n", regressions, percent);
+    }
+
+    if (keep) {
+        printf("perf: scratch files kept in %s\n", dir);
+    } else {
+        remove_tree(dir);
+    }
+    return (!corpora || !reported || failures > 0 || regressions > 0) ? EXIT_FAILURE : 0;
+}
+
+void h_option(void) {
+    printf("SYNOPSIS\n"
+           "   Runs keygen, encrypt and decrypt end to end over synthetic corpora,\n"
+           "   checks every round trip and reports throughput, peak RSS and CPU use.\n"
+           "\n"
+           "USAGE\n"
+           "   ./bench [OPTIONS]\n"
+           "\n"
+           "OPTIONS\n"
+           "   -h             Display program help and usage.\n"
+           "   -v             Print each run as it finishes.\n"
+           "   -b bits        Largest key size, from 256 doubling (default: 1024).\n"
+           "   -s size        Largest corpus, from 1K growing 8x; K, M, G suffixes (default: 64K).\n"
+           "   -j threads     Largest batch mode thread count, from 2 doubling (default: 1, no batch runs).\n"
+           "   -x flags       Extra flags for encrypt, such as \"-z\" (default: none).\n"
+           "   -o report      Write report.csv and report.json (default: perf).\n"
+           "   -c baseline    Compare against an earlier report's csv file.\n"
+           "   -r percent     Slowdown against the baseline that counts as a regression (default: 10).\n"
+           "   -d dir         Make the scratch directory in dir (default: .).\n"
+           "   -k             Keep the scratch directory.\n");
+}
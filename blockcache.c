@@ -0,0 +1,171 @@
+#include "blockcache.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct entry {
+    struct entry *chain; // next entry in the same bucket
+    struct entry *prev, *next; // LRU list, head is most recently used
+    uint64_t hash;
+    size_t klen, vlen;
+    uint8_t data[]; // key bytes followed by value bytes
+} entry_t;
+
+struct blockcache {
+    entry_t **buckets;
+    uint64_t mask;
+    uint64_t capacity, size;
+    entry_t *head, *tail;
+    uint64_t hits, misses, evictions;
+};
+
+// FNV-1a
+static uint64_t hash_bytes(const uint8_t *key, size_t klen) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < klen; i++) {
+        h ^= key[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void entry_free(entry_t *e) {
+    // cached entries hold plaintext
+    volatile uint8_t *p = e->data;
+    for (size_t i = 0; i < e->klen + e->vlen; i++) {
+        p[i] = 0;
+    }
+    free(e);
+}
+
+static void lru_unlink(blockcache_t *bc, entry_t *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        bc->head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        bc->tail = e->prev;
+    }
+}
+
+static void lru_push(blockcache_t *bc, entry_t *e) {
+    e->prev = NULL;
+    e->next = bc->head;
+    if (bc->head) {
+        bc->head->prev = e;
+    }
+    bc->head = e;
+    if (bc->tail == NULL) {
+        bc->tail = e;
+    }
+}
+
+static entry_t **bucket_find(blockcache_t *bc, uint64_t hash, const uint8_t *key, size_t klen) {
+    entry_t **slot = &bc->buckets[hash & bc->mask];
+    while (*slot != NULL) {
+        entry_t *e = *slot;
+        if (e->hash == hash && e->klen == klen && memcmp(e->data, key, klen) == 0) {
+            break;
+        }
+        slot = &e->chain;
+    }
+    return slot;
+}
+
+blockcache_t *blockcache_create(uint64_t capacity) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    blockcache_t *bc = (blockcache_t *) calloc(1, sizeof(blockcache_t));
+    if (bc == NULL) {
+        return NULL;
+    }
+    // keep the load factor at or below 1/2
+    uint64_t buckets = 1;
+    while (buckets < 2 * capacity) {
+        buckets <<= 1;
+    }
+    bc->buckets = (entry_t **) calloc(buckets, sizeof(entry_t *));
+    if (bc->buckets == NULL) {
+        free(bc);
+        return NULL;
+    }
+    bc->mask = buckets - 1;
+    bc->capacity = capacity;
+    return bc;
+}
+
+void blockcache_delete(blockcache_t **bc) {
+    if (*bc == NULL) {
+        return;
+    }
+    entry_t *e = (*bc)->head;
+    while (e != NULL) {
+        entry_t *next = e->next;
+        entry_free(e);
+        e = next;
+    }
+    free((*bc)->buckets);
+    free(*bc);
+    *bc = NULL;
+}
+
+bool blockcache_lookup(
+    blockcache_t *bc, const uint8_t *key, size_t klen, const uint8_t **val, size_t *vlen) {
+    entry_t *e = *bucket_find(bc, hash_bytes(key, klen), key, klen);
+    if (e == NULL) {
+        bc->misses += 1;
+        return false;
+    }
+    bc->hits += 1;
+    lru_unlink(bc, e);
+    lru_push(bc, e);
+    *val = e->data + e->klen;
+    *vlen = e->vlen;
+    return true;
+}
+
+void blockcache_insert(
+    blockcache_t *bc, const uint8_t *key, size_t klen, const uint8_t *val, size_t vlen) {
+    uint64_t hash = hash_bytes(key, klen);
+    if (*bucket_find(bc, hash, key, klen) != NULL) {
+        return;
+    }
+    if (bc->size == bc->capacity) {
+        // evict the least recently used entry
+        entry_t *old = bc->tail;
+        entry_t **slot = bucket_find(bc, old->hash, old->data, old->klen);
+        *slot = old->chain;
+        lru_unlink(bc, old);
+        entry_free(old);
+        bc->size -= 1;
+        bc->evictions += 1;
+    }
+    entry_t *e = (entry_t *) malloc(sizeof(entry_t) + klen + vlen);
+    if (e == NULL) {
+        return;
+    }
+    e->hash = hash;
+    e->klen = klen;
+    e->vlen = vlen;
+    memcpy(e->data, key, klen);
+    memcpy(e->data + klen, val, vlen);
+    entry_t **slot = &bc->buckets[hash & bc->mask];
+    e->chain = *slot;
+    *slot = e;
+    lru_push(bc, e);
+    bc->size += 1;
+}
+
+void blockcache_print_stats(const blockcache_t *bc, FILE *outfile) {
+    fprintf(outfile,
+        "cache: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " evictions, %" PRIu64
+        " entries\n",
+        bc->hits, bc->misses, bc->evictions, bc->size);
+}
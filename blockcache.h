@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Bounded LRU cache mapping one block's bytes to the bytes it encrypts or
+// decrypts to. SS encryption is deterministic, so repeated blocks (zero
+// pages, repeated records) can skip the modexp entirely.
+//
+typedef struct blockcache blockcache_t;
+
+//
+// Creates a cache holding at most capacity entries.
+// Returns NULL if capacity is 0 or memory is exhausted.
+//
+blockcache_t *blockcache_create(uint64_t capacity);
+
+//
+// Frees the cache, zeroing every cached entry, and sets *bc to NULL.
+//
+void blockcache_delete(blockcache_t **bc);
+
+//
+// Looks up a block and marks it most recently used.
+//
+// Provides:
+//  val: cached output bytes, valid until the next insert
+//  vlen: number of cached output bytes
+//  returns true on a hit, false on a miss
+//
+bool blockcache_lookup(
+    blockcache_t *bc, const uint8_t *key, size_t klen, const uint8_t **val, size_t *vlen);
+
+//
+// Inserts a block's output, evicting the least recently used entry if full.
+//
+void blockcache_insert(
+    blockcache_t *bc, const uint8_t *key, size_t klen, const uint8_t *val, size_t vlen);
+
+//
+// Prints hit and miss counters to outfile.
+//
+void blockcache_print_stats(const blockcache_t *bc, FILE *outfile);
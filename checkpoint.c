@@ -0,0 +1,278 @@
+#include "checkpoint.h"
+#include "ss.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHUNK (1 << 20) // bytes per read
+
+// what the journal records
+typedef struct {
+    bool encrypt;
+    uint64_t key; // fingerprint of n or pq
+    uint64_t in_size;
+    int64_t in_sec, in_nsec; // input modification time
+    uint64_t k;
+    uint64_t done; // blocks completed
+    uint64_t in_off, out_off;
+} journal_t;
+
+// FNV-1a over the hex digits of the key; enough to tell keys apart, and pq is not written out
+static uint64_t fingerprint(const mpz_t key) {
+    char *hex = mpz_get_str(NULL, 16, key);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char *c = hex; *c != '\0'; c++) {
+        h = (h ^ (uint8_t) *c) * 0x100000001b3ull;
+    }
+    void (*gmp_free)(void *, size_t);
+    mp_get_memory_functions(NULL, NULL, &gmp_free);
+    gmp_free(hex, strlen(hex) + 1);
+    return h;
+}
+
+static char *journal_path(const char *out_path) {
+    size_t len = strlen(out_path) + strlen(CHECKPOINT_SUFFIX) + 1;
+    char *path = (char *) malloc(len);
+    snprintf(path, len, "%s%s", out_path, CHECKPOINT_SUFFIX);
+    return path;
+}
+
+// make outfile durable, then replace the journal in one rename
+static bool journal_write(const char *path, FILE *outfile, const journal_t *j) {
+    if (fflush(outfile) != 0 || fsync(fileno(outfile)) != 0) {
+        return false;
+    }
+    size_t len = strlen(path) + 5;
+    char *tmp = (char *) malloc(len);
+    snprintf(tmp, len, "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    bool ok = (f != NULL);
+    if (ok) {
+        fprintf(f,
+            CHECKPOINT_MAGIC "\n%s\nkey %016" PRIx64 "\ninput %" PRIu64 " %" PRId64 " %" PRId64
+                             "\nblock %" PRIu64 "\ndone %" PRIu64 "\noffsets %" PRIu64
+                             " %" PRIu64 "\n",
+            j->encrypt ? "encrypt" : "decrypt", j->key, j->in_size, j->in_sec, j->in_nsec, j->k,
+            j->done, j->in_off, j->out_off);
+        ok = (fflush(f) == 0 && fsync(fileno(f)) == 0);
+        ok = (fclose(f) == 0) && ok;
+    }
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        remove(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+static bool journal_read(const char *path, journal_t *j) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char magic[32], op[16];
+    bool ok = fgets(magic, sizeof(magic), f) != NULL && strcmp(magic, CHECKPOINT_MAGIC "\n") == 0
+              && fscanf(f,
+                     "%15s key %" SCNx64 " input %" SCNu64 " %" SCNd64 " %" SCNd64
+                     " block %" SCNu64 " done %" SCNu64 " offsets %" SCNu64 " %" SCNu64,
+                     op, &j->key, &j->in_size, &j->in_sec, &j->in_nsec, &j->k, &j->done,
+                     &j->in_off, &j->out_off)
+                     == 9;
+    j->encrypt = ok && strcmp(op, "encrypt") == 0;
+    ok = ok && (j->encrypt || strcmp(op, "decrypt") == 0);
+    fclose(f);
+    return ok;
+}
+
+//
+// Fill in the journal for a fresh run, or check the saved one and move both
+// files to its offsets. Reports what went wrong on stderr.
+//
+static bool checkpoint_start(FILE *infile, FILE *outfile, const char *journal, journal_t *j,
+    bool resume) {
+    struct stat in_st, out_st;
+    if (fstat(fileno(infile), &in_st) != 0 || !S_ISREG(in_st.st_mode)
+        || fstat(fileno(outfile), &out_st) != 0 || !S_ISREG(out_st.st_mode)) {
+        fprintf(stderr, "checkpoint: input and output must be regular files\n");
+        return false;
+    }
+    j->in_size = (uint64_t) in_st.st_size;
+    j->in_sec = (int64_t) in_st.st_mtim.tv_sec;
+    j->in_nsec = (int64_t) in_st.st_mtim.tv_nsec;
+    off_t start = ftello(infile);
+    j->in_off = start > 0 ? (uint64_t) start : 0;
+    off_t out_start = ftello(outfile);
+    j->out_off = out_start > 0 ? (uint64_t) out_start : 0;
+    j->done = 0;
+    if (!resume) {
+        // a journal from the start, so even a run that dies before its first checkpoint resumes
+        if (!journal_write(journal, outfile, j)) {
+            fprintf(stderr, "%s: unable to write checkpoint\n", journal);
+            return false;
+        }
+        return true;
+    }
+    journal_t saved;
+    if (!journal_read(journal, &saved)) {
+        fprintf(stderr, "%s: no checkpoint to resume from\n", journal);
+        return false;
+    }
+    if (saved.encrypt != j->encrypt || saved.key != j->key || saved.k != j->k) {
+        fprintf(stderr, "%s: checkpoint is for another %s or key\n", journal,
+            saved.encrypt != j->encrypt ? "operation" : "block size");
+        return false;
+    }
+    if (saved.in_size != j->in_size || saved.in_sec != j->in_sec || saved.in_nsec != j->in_nsec
+        || saved.in_off < j->in_off || saved.in_off > j->in_size) {
+        fprintf(stderr, "%s: input has changed since the checkpoint\n", journal);
+        return false;
+    }
+    if ((uint64_t) out_st.st_size < saved.out_off) {
+        fprintf(stderr, "%s: output is shorter than its checkpoint\n", journal);
+        return false;
+    }
+    // anything written after the checkpoint is redone
+    if (ftruncate(fileno(outfile), (off_t) saved.out_off) != 0
+        || fseeko(outfile, (off_t) saved.out_off, SEEK_SET) != 0
+        || fseeko(infile, (off_t) saved.in_off, SEEK_SET) != 0) {
+        fprintf(stderr, "%s: %s\n", journal, strerror(errno));
+        return false;
+    }
+    *j = saved;
+    return true;
+}
+
+// the run is over: sync the output and drop the journal
+static bool checkpoint_finish(FILE *outfile, const char *journal, bool ok) {
+    if (ok && (fflush(outfile) != 0 || fsync(fileno(outfile)) != 0)) {
+        ok = false;
+    }
+    if (ok) {
+        remove(journal);
+    }
+    return ok;
+}
+
+bool checkpoint_encrypt_file(FILE *infile, FILE *outfile, const char *out_path, const mpz_t n,
+    uint64_t block, blockcache_t *cache, uint64_t interval, bool resume) {
+    ss_encrypt_ctx ctx;
+    ss_encrypt_init(&ctx, n, block, cache);
+    char *journal = journal_path(out_path);
+    journal_t j = { .encrypt = true, .key = fingerprint(n), .k = ctx.k };
+    bool ok = checkpoint_start(infile, outfile, journal, &j, resume);
+    // whole blocks per read, so every read leaves the context empty at a block boundary
+    uint64_t payload = ctx.k - 1;
+    size_t chunk = (CHUNK / payload > 0 ? CHUNK / payload : 1) * payload;
+    uint8_t *in = (uint8_t *) malloc(chunk);
+    size_t out_cap = ss_encrypt_max_output(&ctx, chunk);
+    uint8_t *out = (uint8_t *) malloc(out_cap);
+    size_t got, out_len;
+    uint64_t since = 0;
+    while (ok && (got = fread(in, sizeof(uint8_t), chunk, infile)) > 0) {
+        out_len = out_cap;
+        ss_encrypt_update(&ctx, out, &out_len, in, got);
+        ok = fwrite(out, sizeof(uint8_t), out_len, outfile) == out_len;
+        j.in_off += got;
+        j.out_off += out_len;
+        j.done += got / payload;
+        since += got;
+        if (ok && since >= interval && ctx.fill == 0) {
+            ok = journal_write(journal, outfile, &j);
+            since = 0;
+            if (!ok) {
+                fprintf(stderr, "%s: unable to write checkpoint\n", journal);
+            }
+        }
+    }
+    if (ok) {
+        out_len = out_cap;
+        ss_encrypt_final(&ctx, out, &out_len);
+        ok = fwrite(out, sizeof(uint8_t), out_len, outfile) == out_len && !ferror(infile);
+    }
+    ok = checkpoint_finish(outfile, journal, ok);
+    free(out);
+    free(in);
+    free(journal);
+    ss_encrypt_clear(&ctx);
+    return ok;
+}
+
+bool checkpoint_decrypt_file(FILE *infile, FILE *outfile, const char *out_path, const mpz_t d,
+    const mpz_t pq, blockcache_t *cache, uint64_t interval, bool resume) {
+    ss_decrypt_ctx ctx;
+    ss_decrypt_init(&ctx, d, pq, cache);
+    char *journal = journal_path(out_path);
+    journal_t j = { .encrypt = false, .key = fingerprint(pq), .k = ctx.k };
+    bool ok = checkpoint_start(infile, outfile, journal, &j, resume);
+    bool malformed = false;
+    uint8_t *in = (uint8_t *) malloc(CHUNK);
+    size_t out_cap = ctx.k;
+    uint8_t *out = (uint8_t *) malloc(out_cap);
+    size_t got, out_len;
+    uint64_t since = 0;
+    while (ok && (got = fread(in, sizeof(uint8_t), CHUNK, infile)) > 0) {
+        size_t need = ss_decrypt_max_output(&ctx, in, got);
+        if (need > out_cap) {
+            out_cap = need;
+            out = (uint8_t *) realloc(out, out_cap);
+        }
+        out_len = out_cap;
+        malformed = !ss_decrypt_update(&ctx, out, &out_len, in, got);
+        ok = !malformed && fwrite(out, sizeof(uint8_t), out_len, outfile) == out_len;
+        // a line cut off at the end of the read is not done yet; resuming rereads it
+        j.in_off += got;
+        j.out_off += out_len;
+        for (size_t i = 0; i < got; i++) {
+            j.done += (in[i] == '\n');
+        }
+        since += got;
+        if (ok && since >= interval) {
+            journal_t at_line = j;
+            at_line.in_off -= ctx.line_len;
+            ok = journal_write(journal, outfile, &at_line);
+            since = 0;
+            if (!ok) {
+                fprintf(stderr, "%s: unable to write checkpoint\n", journal);
+            }
+        }
+    }
+    if (ok) {
+        out_len = out_cap;
+        malformed = !ss_decrypt_final(&ctx, out, &out_len);
+        ok = !malformed && fwrite(out, sizeof(uint8_t), out_len, outfile) == out_len
+             && !ferror(infile);
+    }
+    if (malformed) {
+        fprintf(stderr, "decrypt: malformed ciphertext line\n");
+    }
+    ok = checkpoint_finish(outfile, journal, ok);
+    free(out);
+    free(in);
+    free(journal);
+    ss_decrypt_clear(&ctx);
+    return ok;
+}
+
+bool checkpoint_parse_interval(const char *mib, uint64_t *interval) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(mib, &end, 10);
+    // strtoull() would wrap a leading minus sign around
+    if (mib[0] == '-' || end == mib || *end != '\0' || errno != 0 || n == 0
+        || n > (UINT64_MAX >> 20)) {
+        return false;
+    }
+    *interval = (uint64_t) n << 20;
+    return true;
+}
+
+bool checkpoint_pending(const char *out_path) {
+    char *journal = journal_path(out_path);
+    struct stat st;
+    bool pending = (lstat(journal, &st) == 0);
+    free(journal);
+    return pending;
+}
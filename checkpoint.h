@@ -0,0 +1,96 @@
+#pragma once
+
+#include "blockcache.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+
+//
+// Checkpointed, resumable encryption and decryption.
+//
+// Block boundaries are fixed (k − 1 plaintext bytes to one ciphertext
+// line), so a run can stop after any block and pick up exactly there.
+// Every interval bytes of input the output is flushed and fsynced, and
+// only then is a small journal next to it, outfile.ckpt, replaced with
+//
+//   ss-checkpoint 1
+//   encrypt                          (or decrypt)
+//   key <fingerprint of n or pq>
+//   input <size> <mtime seconds> <mtime nanoseconds>
+//   block <k>
+//   done <blocks completed>
+//   offsets <input offset> <output offset>
+//
+// so the journal never points past output that is on disk. Resuming checks
+// that the journal was written for this operation, key and unchanged input,
+// cuts off whatever the output gained after the checkpoint and carries on
+// from the recorded offsets. The journal is removed once the run completes.
+//
+// Both files must be regular files: the input is seeked and the output
+// fsynced and truncated.
+//
+
+#define CHECKPOINT_MAGIC    "ss-checkpoint 1"
+#define CHECKPOINT_SUFFIX   ".ckpt"
+#define CHECKPOINT_INTERVAL (64 << 20) // default input bytes between checkpoints
+
+//
+// Encrypt infile to outfile, checkpointing as it goes
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile, as ss_encrypt_file_cached() does
+//
+// Requires:
+//  infile: open and readable regular file, at the start of the plaintext
+//  outfile: regular file opened "w", or "r+" to resume
+//  out_path: path outfile was opened from; the journal is out_path.ckpt
+//  n: public exponent and modulus
+//  block: block size recorded in the public key, or 0
+//  cache: block cache for this key, or NULL to encrypt every block
+//  interval: input bytes between checkpoints
+//  resume: continue from the journal instead of starting over
+//
+// Returns false, with the reason on stderr, if the journal is missing or does
+// not match, or reading, writing or syncing failed. The journal is kept then,
+// so the run can be resumed.
+//
+bool checkpoint_encrypt_file(FILE *infile, FILE *outfile, const char *out_path, const mpz_t n,
+    uint64_t block, blockcache_t *cache, uint64_t interval, bool resume);
+
+//
+// Decrypt infile to outfile, checkpointing as it goes
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile, as ss_decrypt_file_cached() does
+//
+// Requires:
+//  infile: open and readable regular file, at the first ciphertext line
+//  outfile: regular file opened "w", or "r+" to resume
+//  out_path: path outfile was opened from; the journal is out_path.ckpt
+//  d: private exponent
+//  pq: private modulus
+//  cache: block cache for this key, or NULL to decrypt every line
+//  interval: input bytes between checkpoints
+//  resume: continue from the journal instead of starting over
+//
+// Returns false, with the reason on stderr, as checkpoint_encrypt_file()
+// does, or if infile holds a malformed line.
+//
+bool checkpoint_decrypt_file(FILE *infile, FILE *outfile, const char *out_path, const mpz_t d,
+    const mpz_t pq, blockcache_t *cache, uint64_t interval, bool resume);
+
+//
+// Parses the argument of -k, a whole number of MiB from 1 up
+//
+// Provides:
+//  interval: that many MiB, in bytes
+//  returns false, leaving interval alone, if mib is not such a number or overflows
+//
+bool checkpoint_parse_interval(const char *mib, uint64_t *interval);
+
+//
+// Whether out_path.ckpt exists, left by a run that can still be resumed.
+// Starting over would overwrite both the output and the journal.
+//
+bool checkpoint_pending(const char *out_path);
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE // fopencookie
+#include "codec.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#define CODEC_CHUNK 65536
+
+typedef struct {
+    FILE *file; // the wrapped stream, not owned
+    z_stream z;
+    uint8_t buf[CODEC_CHUNK];
+    bool eof; // compressing: all of file has been read
+    bool done; // the end of the zlib stream has been reached
+} codec_stream_t;
+
+void codec_write_header(FILE *outfile, codec_t codec) {
+    if (codec == CODEC_ZLIB) {
+        fprintf(outfile, "%s\n", CODEC_ZLIB_MAGIC);
+    }
+}
+
+bool codec_read_header(FILE *infile, codec_t *codec) {
+    *codec = CODEC_NONE;
+    int first = getc(infile);
+    if (first == EOF) {
+        return true;
+    }
+    ungetc(first, infile);
+    // ciphertext lines are all hex digits
+    if (first != CODEC_ZLIB_MAGIC[0]) {
+        return true;
+    }
+    char line[32];
+    if (fgets(line, sizeof(line), infile) == NULL || strcmp(line, CODEC_ZLIB_MAGIC "\n") != 0) {
+        return false;
+    }
+    *codec = CODEC_ZLIB;
+    return true;
+}
+
+static ssize_t deflate_read(void *cookie, char *out, size_t size) {
+    codec_stream_t *s = (codec_stream_t *) cookie;
+    s->z.next_out = (Bytef *) out;
+    s->z.avail_out = (uInt) size;
+    while (s->z.avail_out > 0 && !s->done) {
+        if (s->z.avail_in == 0 && !s->eof) {
+            size_t got = fread(s->buf, sizeof(uint8_t), CODEC_CHUNK, s->file);
+            if (ferror(s->file)) {
+                return -1;
+            }
+            s->eof = (got < CODEC_CHUNK);
+            s->z.next_in = s->buf;
+            s->z.avail_in = (uInt) got;
+        }
+        int ret = deflate(&s->z, s->eof ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            s->done = true;
+        } else if (ret == Z_STREAM_ERROR) {
+            return -1;
+        }
+    }
+    return (ssize_t) (size - s->z.avail_out);
+}
+
+static int deflate_close(void *cookie) {
+    codec_stream_t *s = (codec_stream_t *) cookie;
+    deflateEnd(&s->z);
+    free(s);
+    return 0;
+}
+
+static ssize_t inflate_write(void *cookie, const char *in, size_t size) {
+    codec_stream_t *s = (codec_stream_t *) cookie;
+    s->z.next_in = (Bytef *) in;
+    s->z.avail_in = (uInt) size;
+    // keep going while there is input, or inflate filled the buffer and may have more
+    do {
+        s->z.next_out = s->buf;
+        s->z.avail_out = CODEC_CHUNK;
+        int ret = inflate(&s->z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            s->done = true;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            return -1;
+        }
+        size_t have = CODEC_CHUNK - s->z.avail_out;
+        if (fwrite(s->buf, sizeof(uint8_t), have, s->file) != have) {
+            return -1;
+        }
+    } while (!s->done && (s->z.avail_in > 0 || s->z.avail_out == 0));
+    if (s->done && s->z.avail_in > 0) {
+        // data past the end of the zlib stream
+        return -1;
+    }
+    return (ssize_t) size;
+}
+
+static int inflate_close(void *cookie) {
+    codec_stream_t *s = (codec_stream_t *) cookie;
+    // a stream cut short never reaches its end
+    bool done = s->done;
+    inflateEnd(&s->z);
+    free(s);
+    return done ? 0 : EOF;
+}
+
+FILE *codec_compress_reader(FILE *infile, codec_t codec) {
+    if (codec != CODEC_ZLIB) {
+        return NULL;
+    }
+    codec_stream_t *s = (codec_stream_t *) calloc(1, sizeof(codec_stream_t));
+    if (s == NULL || deflateInit(&s->z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        free(s);
+        return NULL;
+    }
+    s->file = infile;
+    cookie_io_functions_t io = { deflate_read, NULL, NULL, deflate_close };
+    FILE *f = fopencookie(s, "r", io);
+    if (f == NULL) {
+        deflate_close(s);
+    }
+    return f;
+}
+
+FILE *codec_decompress_writer(FILE *outfile, codec_t codec) {
+    if (codec != CODEC_ZLIB) {
+        return NULL;
+    }
+    codec_stream_t *s = (codec_stream_t *) calloc(1, sizeof(codec_stream_t));
+    if (s == NULL || inflateInit(&s->z) != Z_OK) {
+        free(s);
+        return NULL;
+    }
+    s->file = outfile;
+    cookie_io_functions_t io = { NULL, inflate_write, NULL, inflate_close };
+    FILE *f = fopencookie(s, "w", io);
+    if (f == NULL) {
+        inflateEnd(&s->z);
+        free(s);
+    }
+    return f;
+}
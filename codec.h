@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+
+//
+// Optional compression in front of encryption.
+//
+// Every k − 1 bytes of plaintext cost a modexp, so compressing first cuts
+// the work on redundant input (logs, JSON, text) by the compression ratio.
+// An encrypted file made from compressed data carries the line
+//
+//   zlib 1
+//
+// just before its ciphertext lines (after a multi-recipient header, if
+// any), so the decryptor knows to decompress what it decrypts. Like the
+// multi-recipient header, it starts with a letter that no hex digit or
+// other header starts with, so one byte of lookahead tells them apart.
+//
+
+typedef enum {
+    CODEC_NONE, // plaintext is encrypted as is
+    CODEC_ZLIB, // plaintext is a zlib stream
+} codec_t;
+
+#define CODEC_ZLIB_MAGIC "zlib 1"
+
+//
+// Writes the header line for codec to outfile; nothing for CODEC_NONE.
+//
+void codec_write_header(FILE *outfile, codec_t codec);
+
+//
+// Reads the header line, if there is one, leaving infile at the ciphertext.
+//
+// Provides:
+//  codec: the codec recorded in the header, or CODEC_NONE without one
+//
+// Returns false if infile starts with a header line that is not a codec's.
+//
+bool codec_read_header(FILE *infile, codec_t *codec);
+
+//
+// A stream whose reads give the compressed contents of infile.
+//
+// Requires:
+//  infile: open and readable file stream, still owned and closed by the caller
+//
+// Returns NULL if the stream could not be set up. Closing the returned
+// stream does not close infile.
+//
+FILE *codec_compress_reader(FILE *infile, codec_t codec);
+
+//
+// A stream that decompresses what is written to it into outfile.
+//
+// Requires:
+//  outfile: open and writable file stream, still owned and closed by the caller
+//
+// Returns NULL if the stream could not be set up. Writes fail once the data
+// is found to be corrupt, and closing the returned stream (which does not
+// close outfile) fails if the compressed data was corrupt or cut short.
+//
+FILE *codec_decompress_writer(FILE *outfile, codec_t codec);
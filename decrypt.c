@@ -3,14 +3,28 @@
 #include "ss.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "arena.h"
+#include "backend.h"
+#include "uring.h"
+#include "batch.h"
+#include "multi.h"
+#include "codec.h"
+#include "checkpoint.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "inttypes.h"
 #include <sys/stat.h>
-#define OPTIONS "vn:i:o:h"
+#define OPTIONS "vn:i:o:hac:ubD:O:x:j:k:r"
+
+// --resume is the long form of -r
+static const struct option long_options[] = {
+    { "resume", no_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 },
+};
 
 // received CSE 13S TA/tutor instruction in setting file permissions, username, and verbose output.
 
@@ -28,6 +42,16 @@ void usage(char *exec) {
         "OPTIONS\n"
         "   -h             Display program help and output.\n"
         "   -v             Display verbose program output.\n"
+        "   -a             Use the pooled GMP allocator (-v prints its stats).\n"
+        "   -c entries     Cache up to entries repeated blocks (-v prints its stats).\n"
+        "   -k mib         Checkpoint every mib MiB of input to outfile.ckpt (needs -i and -o).\n"
+        "   -r, --resume   Resume from the checkpoint of an interrupted -k run.\n"
+        "   -u             Use io_uring for file I/O when available (-v prints its stats).\n"
+        "   -b             Batch mode: decrypt each file named in infile.\n"
+        "   -D dir         Batch mode: decrypt each file ending in the suffix in dir.\n"
+        "   -O outdir      Batch output directory (default: next to each input).\n"
+        "   -x suffix      Batch suffix removed from inputs (default: .enc).\n"
+        "   -j threads     Batch worker threads (default: one per CPU).\n"
         "   -i infile      Input file of data to decrypt (default: stdin).\n"
         "   -o outfile     Output file for decrypted data (default: stdout).\n"
         "   -n pvfile      Private key file (default: ss.pub).\n",
@@ -36,16 +60,40 @@ void usage(char *exec) {
 
 int main(int argc, char **argv) {
     bool verbose_output = false;
+    bool use_arena = false;
+    bool use_uring = false;
+    bool batch_list = false;
+    char *batch_dir = NULL;
+    batch_opts_t batch_opts = { NULL, ".enc", 0, 0, false, CODEC_NONE };
+    uint64_t cache_entries = 0;
     FILE *private_key_file;
     private_key_file = fopen("ss.priv", "r");
     FILE *input_file = stdin;
     FILE *output_file = stdout;
+    char *output_path = NULL;
+    uint64_t checkpoint_interval = 0;
+    bool resume = false;
 
     int opt = 0;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'v': verbose_output = true; break;
+        case 'a': use_arena = true; break;
+        case 'c': cache_entries = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'u': use_uring = true; break;
+        case 'b': batch_list = true; break;
+        case 'D': batch_dir = optarg; break;
+        case 'O': batch_opts.outdir = optarg; break;
+        case 'x': batch_opts.suffix = optarg; break;
+        case 'j': batch_opts.threads = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'k':
+            if (!checkpoint_parse_interval(optarg, &checkpoint_interval)) {
+                printf("%s: checkpoint interval must be a whole number of MiB, at least 1\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r': resume = true; break;
         case 'n':
             private_key_file = fopen(optarg, "r");
             if (private_key_file == NULL) {
@@ -62,8 +110,8 @@ int main(int argc, char **argv) {
                 return -1;
             };
             break;
-        // output file
-        case 'o': output_file = fopen(optarg, "w"); break;
+        // output file, opened once we know whether a run is being resumed
+        case 'o': output_path = optarg; break;
         // help
         case 'h':
             h_option();
@@ -75,6 +123,36 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Checkpoints are taken over one ciphertext file; resuming implies them.
+    bool checkpointing = checkpoint_interval > 0 || resume;
+    if (checkpointing
+        && (batch_list || batch_dir != NULL || input_file == stdin || output_path == NULL)) {
+        printf("checkpointing needs -i and -o, and not batch mode\n");
+        return EXIT_FAILURE;
+    }
+    // Starting over would throw away a run that can still be resumed.
+    if (checkpointing && !resume && checkpoint_pending(output_path)) {
+        printf("%s%s exists: add -r to resume that run, or delete it to start over\n",
+            output_path, CHECKPOINT_SUFFIX);
+        return EXIT_FAILURE;
+    }
+    if (output_path != NULL) {
+        // A resumed run keeps what the interrupted one wrote.
+        output_file = fopen(output_path, resume ? "r+" : "w");
+        if (output_file == NULL) {
+            printf("%s: No such file or directory\n", output_path);
+            return -1;
+        }
+    }
+
+    // Pick the modexp backends tuned for this machine by the tune program, if it has been run.
+    backend_load(NULL);
+
+    // The pooled allocator must be in place before any mpz_t is initialized; it zeroes the private key material it releases.
+    if (use_arena) {
+        arena_install(true);
+    }
+
     mpz_t pq, d, n;
     mpz_inits(pq, d, n, NULL);
 
@@ -87,18 +165,114 @@ int main(int argc, char **argv) {
     if (verbose_output) {
         gmp_printf("pq  (%u bits) = %Zd\n", pqbits, pq);
         gmp_printf("d   (%u bits) = %Zd\n", dbits, d);
+        printf("backend = %s\n", backend_for_secret(pqbits)->name);
     }
 
-    // Decrypt the file using ss_decrypt_file().
-    ss_decrypt_file(input_file, output_file, d, pq);
+    uring_status_t status = URING_UNAVAILABLE;
+    uint64_t failed = 0;
+    if (batch_list || batch_dir != NULL) {
+        // Batch mode: the key above is read once and shared, read only, by every worker thread.
+        char **paths;
+        uint64_t count;
+        if (batch_dir == NULL) {
+            batch_list_stream(input_file, &paths, &count);
+        } else if (!batch_list_dir(batch_dir, batch_opts.suffix, &paths, &count)) {
+            printf("%s: No such file or directory\n", batch_dir);
+            failed = 1;
+        }
+        if (failed == 0) {
+            batch_opts.cache_entries = cache_entries;
+            batch_opts.verbose = verbose_output;
+            failed = batch_decrypt(paths, count, d, pq, &batch_opts);
+            if (verbose_output) {
+                fprintf(stderr, "batch: %" PRIu64 " files, %" PRIu64 " failed\n", count, failed);
+            }
+            batch_free_list(paths, count);
+        }
+    } else {
+        // A multi-recipient container names its recipients first, then a compressed file has its codec line.
+        blockcache_t *cache = blockcache_create(cache_entries);
+        bool multi = multi_is_container(input_file);
+        uint64_t index, count;
+        codec_t codec;
+        FILE *plain_file = output_file;
+        if (multi && !multi_find_section(input_file, pq, &index, &count)) {
+            fprintf(stderr, "decrypt: not a recipient of this file\n");
+            failed = 1;
+        } else if (!codec_read_header(input_file, &codec)) {
+            fprintf(stderr, "decrypt: unknown compression header\n");
+            failed = 1;
+        } else if (checkpointing && (multi || codec != CODEC_NONE)) {
+            fprintf(stderr, "decrypt: checkpointing works on single-key, uncompressed files\n");
+            failed = 1;
+        } else if (codec != CODEC_NONE
+                   && (plain_file = codec_decompress_writer(output_file, codec)) == NULL) {
+            fprintf(stderr, "decrypt: unable to start decompression\n");
+            plain_file = output_file;
+            failed = 1;
+        } else if (multi) {
+            // Decrypt only this key's section of the container.
+            if (!multi_decrypt_section(input_file, plain_file, d, pq, index, count, cache)) {
+                fprintf(stderr, "decrypt: malformed or unreadable container\n");
+                failed = 1;
+            }
+        } else {
+            // Decrypt the file using ss_decrypt_file(), skipping the modexp for repeated lines if asked to.
+            if (use_uring && !checkpointing) {
+                // io_uring takes over the file descriptors, so nothing may be left in the stdio buffers.
+                fflush(output_file);
+                ss_decrypt_ctx ctx;
+                uring_stats_t stats;
+                ss_decrypt_init(&ctx, d, pq, cache);
+                status = uring_decrypt_file(input_file, plain_file, &ctx, &stats);
+                ss_decrypt_clear(&ctx);
+                if (status == URING_ERROR) {
+                    fprintf(stderr, "decrypt: error reading, writing or decoding with io_uring\n");
+                }
+                if (status != URING_UNAVAILABLE && verbose_output) {
+                    uring_print_stats(&stats, stderr);
+                }
+            }
+            if (checkpointing) {
+                // Output and journal are synced every interval, so an interrupted run can pick up with -r.
+                uint64_t interval = checkpoint_interval > 0 ? checkpoint_interval : CHECKPOINT_INTERVAL;
+                if (!checkpoint_decrypt_file(
+                        input_file, output_file, output_path, d, pq, cache, interval, resume)) {
+                    failed = 1;
+                }
+            } else if (status == URING_UNAVAILABLE) {
+                if (!ss_decrypt_file_cached(input_file, plain_file, d, pq, cache)) {
+                    fprintf(stderr, "decrypt: malformed or unreadable input\n");
+                    failed = 1;
+                }
+            }
+        }
+        // Closing the decompressor flushes it and checks that the compressed data was whole.
+        if (plain_file != output_file && fclose(plain_file) != 0 && failed == 0) {
+            fprintf(stderr, "decrypt: corrupt or truncated compressed data\n");
+            failed = 1;
+        }
+        if (cache != NULL) {
+            if (verbose_output) {
+                blockcache_print_stats(cache, stderr);
+            }
+            blockcache_delete(&cache);
+        }
+    }
 
     // Close the private key file and clear any mpz_t variables you have used.
     fclose(private_key_file);
     fclose(input_file);
     fclose(output_file);
     mpz_clears(pq, d, n, NULL);
+    if (use_arena) {
+        if (verbose_output) {
+            arena_print_stats(stderr);
+        }
+        arena_reset();
+    }
 
-    return 0;
+    return (status == URING_ERROR || failed > 0) ? EXIT_FAILURE : 0;
 }
 
 void h_option(void) {
@@ -112,6 +286,16 @@ void h_option(void) {
            "OPTIONS\n"
            "   -h             Display program help and output.\n"
            "   -v             Display verbose program output.\n"
+           "   -a             Use the pooled GMP allocator (-v prints its stats).\n"
+           "   -c entries     Cache up to entries repeated blocks (-v prints its stats).\n"
+           "   -k mib         Checkpoint every mib MiB of input to outfile.ckpt (needs -i and -o).\n"
+           "   -r, --resume   Resume from the checkpoint of an interrupted -k run.\n"
+           "   -u             Use io_uring for file I/O when available (-v prints its stats).\n"
+           "   -b             Batch mode: decrypt each file named in infile.\n"
+           "   -D dir         Batch mode: decrypt each file ending in the suffix in dir.\n"
+           "   -O outdir      Batch output directory (default: next to each input).\n"
+           "   -x suffix      Batch suffix removed from inputs (default: .enc).\n"
+           "   -j threads     Batch worker threads (default: one per CPU).\n"
            "   -i infile      Input file of data to decrypt (default: stdin).\n"
            "   -o outfile     Output file for decrypted data (default: stdout).\n"
            "   -n pvfile      Private key file (default: ss.pub).\n");
@@ -3,14 +3,28 @@
 #include "ss.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "arena.h"
+#include "backend.h"
+#include "uring.h"
+#include "batch.h"
+#include "multi.h"
+#include "codec.h"
+#include "checkpoint.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "inttypes.h"
 #include <sys/stat.h>
-#define OPTIONS "vn:i:o:h"
+#define OPTIONS "vn:i:o:hac:ubD:O:x:j:zk:r"
+
+// --resume is the long form of -r
+static const struct option long_options[] = {
+    { "resume", no_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 },
+};
 
 // received CSE 13S TA/tutor instruction in setting file permissions, username, and verbose output.
 
@@ -28,29 +42,73 @@ void usage(char *exec) {
         "OPTIONS\n"
         "   -h             Display program help and output.\n"
         "   -v             Display verbose program output.\n"
+        "   -a             Use the pooled GMP allocator (-v prints its stats).\n"
+        "   -c entries     Cache up to entries repeated blocks (-v prints its stats).\n"
+        "   -z             Compress the data with zlib before encrypting it.\n"
+        "   -k mib         Checkpoint every mib MiB of input to outfile.ckpt (needs -i and -o).\n"
+        "   -r, --resume   Resume from the checkpoint of an interrupted -k run.\n"
+        "   -u             Use io_uring for file I/O when available (-v prints its stats).\n"
+        "   -b             Batch mode: encrypt each file named in infile.\n"
+        "   -D dir         Batch mode: encrypt each file in dir.\n"
+        "   -O outdir      Batch output directory (default: next to each input).\n"
+        "   -x suffix      Batch suffix added to outputs (default: .enc).\n"
+        "   -j threads     Batch worker threads (default: one per CPU).\n"
         "   -i infile      Input file of data to encrypt (default: stdin).\n"
         "   -o outfile     Output file for encrypted data (default: stdout).\n"
-        "   -n pbfile      Public key file (default: ss.pub).\n",
+        "   -n pbfile      Public key file (default: ss.pub); repeat for more recipients.\n",
         exec);
 }
 
 int main(int argc, char **argv) {
     bool verbose_output = false;
+    bool use_arena = false;
+    bool use_uring = false;
+    bool batch_list = false;
+    char *batch_dir = NULL;
+    batch_opts_t batch_opts = { NULL, ".enc", 0, 0, false, CODEC_NONE };
+    uint64_t cache_entries = 0;
     FILE *public_key_file;
     public_key_file = fopen("ss.pub", "r");
+    FILE *recipient_files[MULTI_MAX];
+    uint64_t recipients = 0;
     FILE *input_file = stdin;
     FILE *output_file = stdout;
+    char *output_path = NULL;
+    uint64_t checkpoint_interval = 0;
+    bool resume = false;
 
     int opt = 0;
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'v': verbose_output = true; break;
+        case 'a': use_arena = true; break;
+        case 'c': cache_entries = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'u': use_uring = true; break;
+        case 'z': batch_opts.codec = CODEC_ZLIB; break;
+        case 'b': batch_list = true; break;
+        case 'D': batch_dir = optarg; break;
+        case 'O': batch_opts.outdir = optarg; break;
+        case 'x': batch_opts.suffix = optarg; break;
+        case 'j': batch_opts.threads = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'k':
+            if (!checkpoint_parse_interval(optarg, &checkpoint_interval)) {
+                printf("%s: checkpoint interval must be a whole number of MiB, at least 1\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'r': resume = true; break;
         case 'n':
             public_key_file = fopen(optarg, "r");
             if (public_key_file == NULL) {
                 printf("%s: No such file or directory\n", optarg);
                 return -1;
             };
+            // every -n past the first adds a recipient
+            if (recipients == MULTI_MAX) {
+                printf("%s: more than %d public keys\n", optarg, MULTI_MAX);
+                return -1;
+            }
+            recipient_files[recipients++] = public_key_file;
             break;
         // input file
         // Open the public key file using fopen(). Print a helpful error and exit the program in the event of failure.
@@ -61,8 +119,8 @@ int main(int argc, char **argv) {
                 return -1;
             };
             break;
-        // output file
-        case 'o': output_file = fopen(optarg, "w"); break;
+        // output file, opened once we know whether a run is being resumed
+        case 'o': output_path = optarg; break;
         // help
         case 'h':
             h_option();
@@ -74,32 +132,186 @@ int main(int argc, char **argv) {
         }
     }
 
+    // The first public key is the one used for a single recipient.
+    if (recipients > 0) {
+        public_key_file = recipient_files[0];
+    }
+    if (recipients > 1 && (batch_list || batch_dir != NULL)) {
+        printf("batch mode takes a single public key\n");
+        return EXIT_FAILURE;
+    }
+    // Multi-recipient encryption has neither a block cache nor an io_uring path.
+    if (recipients > 1 && (cache_entries > 0 || use_uring)) {
+        printf("-c and -u take a single public key\n");
+        return EXIT_FAILURE;
+    }
+    // Checkpoints are taken over one plaintext file encrypted to one key; resuming implies them.
+    bool checkpointing = checkpoint_interval > 0 || resume;
+    if (checkpointing
+        && (recipients > 1 || batch_list || batch_dir != NULL || batch_opts.codec != CODEC_NONE
+            || input_file == stdin || output_path == NULL)) {
+        printf("checkpointing needs -i and -o, a single public key, and neither -z nor batch mode\n");
+        return EXIT_FAILURE;
+    }
+    // Starting over would throw away a run that can still be resumed.
+    if (checkpointing && !resume && checkpoint_pending(output_path)) {
+        printf("%s%s exists: add -r to resume that run, or delete it to start over\n",
+            output_path, CHECKPOINT_SUFFIX);
+        return EXIT_FAILURE;
+    }
+    if (output_path != NULL) {
+        // A resumed run keeps what the interrupted one wrote.
+        output_file = fopen(output_path, resume ? "r+" : "w");
+        if (output_file == NULL) {
+            printf("%s: No such file or directory\n", output_path);
+            return -1;
+        }
+    }
+
+    // Pick the modexp backends tuned for this machine by the tune program, if it has been run.
+    backend_load(NULL);
+
+    // The pooled allocator must be in place before any mpz_t is initialized.
+    if (use_arena) {
+        arena_install(false);
+    }
+
     mpz_t n;
     mpz_init(n);
 
-    char *username = "";
-    username = getenv("USER");
+    char username[SS_USERNAME_MAX];
+    uint64_t block;
 
     // Read the public key from the opened public key file
-    ss_read_pub(n, username, public_key_file);
+    if (!ss_read_pub(n, &block, username, public_key_file)) {
+        printf("unable to read public key\n");
+        return EXIT_FAILURE;
+    }
 
     // If verbose output is enabled print the following, each with a trailing newline, in order: username, the public key n
     uint64_t nbits = mpz_sizeinbase(n, 2);
     if (verbose_output) {
         gmp_printf("user = %s\n", username);
         gmp_printf("n (%u bits) = %Zd\n", nbits, n);
+        if (block > 0) {
+            printf("block = %" PRIu64 " bytes\n", block);
+        }
+        printf("backend = %s\n", backend_for(nbits)->name);
     }
 
-    // Encrypt the file using ss_encrypt_file().
-    ss_encrypt_file(input_file, output_file, n);
+    // Compress ahead of block packing if asked to; batch mode compresses each of its files itself.
+    FILE *plain_file = input_file;
+    if (batch_opts.codec != CODEC_NONE && !batch_list && batch_dir == NULL) {
+        plain_file = codec_compress_reader(input_file, batch_opts.codec);
+        if (plain_file == NULL) {
+            printf("unable to start compression\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    uring_status_t status = URING_UNAVAILABLE;
+    uint64_t failed = 0;
+    if (recipients > 1) {
+        // Multi-recipient container: each block is read once and encrypted to every key in parallel.
+        mpz_t ns[MULTI_MAX];
+        uint64_t blocks[MULTI_MAX];
+        mpz_init_set(ns[0], n);
+        blocks[0] = block;
+        for (uint64_t i = 1; i < recipients; i++) {
+            mpz_init(ns[i]);
+            if (!ss_read_pub(ns[i], &blocks[i], username, recipient_files[i])) {
+                printf("unable to read public key %" PRIu64 "\n", i + 1);
+                return EXIT_FAILURE;
+            }
+            if (verbose_output) {
+                gmp_printf("user = %s\n", username);
+                gmp_printf("n (%u bits) = %Zd\n", mpz_sizeinbase(ns[i], 2), ns[i]);
+            }
+            fclose(recipient_files[i]);
+        }
+        multi_write_header(output_file, ns, recipients);
+        codec_write_header(output_file, batch_opts.codec);
+        if (!multi_encrypt_file(plain_file, output_file, ns, blocks, recipients)) {
+            failed = 1;
+        }
+        for (uint64_t i = 0; i < recipients; i++) {
+            mpz_clear(ns[i]);
+        }
+    } else if (batch_list || batch_dir != NULL) {
+        // Batch mode: the key above is read once and shared, read only, by every worker thread.
+        char **paths;
+        uint64_t count;
+        if (batch_dir == NULL) {
+            batch_list_stream(input_file, &paths, &count);
+        } else if (!batch_list_dir(batch_dir, NULL, &paths, &count)) {
+            printf("%s: No such file or directory\n", batch_dir);
+            failed = 1;
+        }
+        if (failed == 0) {
+            batch_opts.cache_entries = cache_entries;
+            batch_opts.verbose = verbose_output;
+            failed = batch_encrypt(paths, count, n, block, &batch_opts);
+            if (verbose_output) {
+                fprintf(stderr, "batch: %" PRIu64 " files, %" PRIu64 " failed\n", count, failed);
+            }
+            batch_free_list(paths, count);
+        }
+    } else {
+        // Encrypt the file using ss_encrypt_file(), skipping the modexp for repeated blocks if asked to.
+        blockcache_t *cache = blockcache_create(cache_entries);
+        codec_write_header(output_file, batch_opts.codec);
+        if (use_uring && !checkpointing) {
+            // io_uring takes over the file descriptors, so nothing may be left in the stdio buffers.
+            fflush(output_file);
+            ss_encrypt_ctx ctx;
+            uring_stats_t stats;
+            ss_encrypt_init(&ctx, n, block, cache);
+            status = uring_encrypt_file(plain_file, output_file, &ctx, &stats);
+            ss_encrypt_clear(&ctx);
+            if (status == URING_ERROR) {
+                fprintf(stderr, "encrypt: error reading or writing with io_uring\n");
+            }
+            if (status != URING_UNAVAILABLE && verbose_output) {
+                uring_print_stats(&stats, stderr);
+            }
+        }
+        if (checkpointing) {
+            // Output and journal are synced every interval, so an interrupted run can pick up with -r.
+            uint64_t interval = checkpoint_interval > 0 ? checkpoint_interval : CHECKPOINT_INTERVAL;
+            if (!checkpoint_encrypt_file(
+                    input_file, output_file, output_path, n, block, cache, interval, resume)) {
+                failed = 1;
+            }
+        } else if (status == URING_UNAVAILABLE) {
+            if (!ss_encrypt_file_cached(plain_file, output_file, n, block, cache)) {
+                fprintf(stderr, "encrypt: error reading input or writing output\n");
+                failed = 1;
+            }
+        }
+        if (cache != NULL) {
+            if (verbose_output) {
+                blockcache_print_stats(cache, stderr);
+            }
+            blockcache_delete(&cache);
+        }
+    }
 
     // Close the public key file and clear any mpz_t variables you have used.
     fclose(public_key_file);
+    if (plain_file != input_file) {
+        fclose(plain_file);
+    }
     fclose(input_file);
     fclose(output_file);
     mpz_clear(n);
+    if (use_arena) {
+        if (verbose_output) {
+            arena_print_stats(stderr);
+        }
+        arena_reset();
+    }
 
-    return 0;
+    return (status == URING_ERROR || failed > 0) ? EXIT_FAILURE : 0;
 }
 
 void h_option(void) {
@@ -113,7 +325,18 @@ void h_option(void) {
            "OPTIONS\n"
            "   -h             Display program help and output.\n"
            "   -v             Display verbose program output.\n"
+           "   -a             Use the pooled GMP allocator (-v prints its stats).\n"
+           "   -c entries     Cache up to entries repeated blocks (-v prints its stats).\n"
+           "   -z             Compress the data with zlib before encrypting it.\n"
+           "   -k mib         Checkpoint every mib MiB of input to outfile.ckpt (needs -i and -o).\n"
+           "   -r, --resume   Resume from the checkpoint of an interrupted -k run.\n"
+           "   -u             Use io_uring for file I/O when available (-v prints its stats).\n"
+           "   -b             Batch mode: encrypt each file named in infile.\n"
+           "   -D dir         Batch mode: encrypt each file in dir.\n"
+           "   -O outdir      Batch output directory (default: next to each input).\n"
+           "   -x suffix      Batch suffix added to outputs (default: .enc).\n"
+           "   -j threads     Batch worker threads (default: one per CPU).\n"
            "   -i infile      Input file of data to encrypt (default: stdin).\n"
            "   -o outfile     Output file for encrypted data (default: stdout).\n"
-           "   -n pbfile      Public key file (default: ss.pub).\n");
+           "   -n pbfile      Public key file (default: ss.pub); repeat for more recipients.\n");
 }
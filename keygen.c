@@ -3,6 +3,8 @@
 #include "ss.h"
 #include "numtheory.h"
 #include "randstate.h"
+#include "primepool.h"
+#include "keyprof.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -10,7 +12,7 @@
 #include <unistd.h>
 #include "inttypes.h"
 #include <sys/stat.h>
-#define OPTIONS "b:i:vn:d:s:h"
+#define OPTIONS "b:i:e:vn:d:s:hp:f:t:"
 
 // received CSE 13S TA/tutor instruction in setting file permissions, username, and verbose output.
  
@@ -26,21 +28,43 @@ void usage(char *exec) {
         "\n"
         "OPTIONS\n"
         "   -h             Display program help and usage.\n"
-        "   -v             Display verbose program output.\n"
+        "   -v             Display verbose program output and keygen profile.\n"
         "   -b bits        Minimum bits needed for public key n (default: 256).\n"
         "   -i iterations  Miller-Rabin iterations for testing (default: 50).\n"
+        "   -e bits        Cap iterations at a 2^-bits error bound (default: off).\n"
         "   -n pbfile      Public key file (default: ss.pub).\n"
         "   -d pvfile      Private key file (default: ss.priv).\n"
-        "   -s seed        Random seed for testing.\n",
+        "   -s seed        Random seed for testing.\n"
+        "   -p poolfile    Take p and q from a prime pool, if it has any.\n"
+        "   -f count       Add count prime pairs to the pool (-p) and exit.\n"
+        "   -t tracefile   Write a Chrome trace of prime generation to tracefile.\n",
         exec);
 }
 
+// print the prime generation profile and write its trace, as asked
+static void write_profile(bool verbose_output, const char *trace_name) {
+    if (verbose_output) {
+        keyprof_print(stderr);
+    }
+    if (trace_name != NULL) {
+        FILE *trace_file = fopen(trace_name, "w");
+        if (trace_file == NULL) {
+            printf("%s: unable to open trace file\n", trace_name);
+        } else {
+            keyprof_write_trace(trace_file);
+            fclose(trace_file);
+        }
+    }
+    keyprof_clear();
+}
+
 int main(int argc, char **argv) {
     bool verbose_output = false;
-    FILE *pb_file;
-    pb_file = fopen("ss.pub", "w");
-    FILE *pv_file;
-    pv_file = fopen("ss.priv", "w");
+    char *pb_name = "ss.pub";
+    char *pv_name = "ss.priv";
+    char *pool_name = NULL;
+    char *trace_name = NULL;
+    uint64_t pool_fill = 0;
     uint64_t miller_rabin_iters = 50;
     uint64_t min_bits = 256;
     uint64_t random_seed = time(NULL);
@@ -51,16 +75,14 @@ int main(int argc, char **argv) {
         switch (opt) {
         case 'b': min_bits = (uint64_t) (strtoul(optarg, NULL, 10)); break;
         case 'i': miller_rabin_iters = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'e': set_prime_error_bound((uint64_t) (strtoul(optarg, NULL, 10))); break;
         case 'v': verbose_output = true; break;
-        case 'n':
-            // Open the public and private key files using fopen(). Print a helpful error and exit the program in the event of failure.
-            pb_file = fopen(optarg, "w");
-            break;
-        case 'd':
-            // Open the public and private key files using fopen(). Print a helpful error and exit the program in the event of failure.
-            pv_file = fopen(optarg, "w");
-            break;
+        case 'n': pb_name = optarg; break;
+        case 'd': pv_name = optarg; break;
         case 's': random_seed = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'p': pool_name = optarg; break;
+        case 'f': pool_fill = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 't': trace_name = optarg; break;
         // help
         case 'h': h_option(); break;
         default:
@@ -69,19 +91,67 @@ int main(int argc, char **argv) {
         }
     }
 
+    // Initialize the random state using randstate_init(), using the set seed.
+    randstate_init(random_seed);
+
+    // Time prime generation when its profile or trace is wanted.
+    if (verbose_output || trace_name != NULL) {
+        keyprof_enable(trace_name != NULL);
+    }
+
+    // Offline mode: top up the prime pool and leave any existing keys alone.
+    if (pool_fill > 0) {
+        if (pool_name == NULL) {
+            fprintf(stderr, "-f requires a prime pool file (-p)\n");
+            randstate_clear();
+            return EXIT_FAILURE;
+        }
+        if (!primepool_fill(pool_name, min_bits, pool_fill, miller_rabin_iters)) {
+            fprintf(stderr, "%s: unable to open prime pool\n", pool_name);
+            randstate_clear();
+            return EXIT_FAILURE;
+        }
+        if (verbose_output) {
+            printf("pool = %s (%" PRIu64 " pairs for %" PRIu64 " bits)\n", pool_name,
+                primepool_count(pool_name, min_bits), min_bits);
+        }
+        write_profile(verbose_output, trace_name);
+        randstate_clear();
+        return 0;
+    }
+
+    // Open the public and private key files using fopen(). Print a helpful error and exit the program in the event of failure.
+    FILE *pb_file = fopen(pb_name, "w");
+    if (pb_file == NULL) {
+        printf("%s: unable to open public key file\n", pb_name);
+        randstate_clear();
+        return EXIT_FAILURE;
+    }
+    FILE *pv_file = fopen(pv_name, "w");
+    if (pv_file == NULL) {
+        printf("%s: unable to open private key file\n", pv_name);
+        fclose(pb_file);
+        randstate_clear();
+        return EXIT_FAILURE;
+    }
+
     // Using fchmod() and fileno(), make sure that the private key file permissions are set to 0600, indicating read and write permissions for the user, and no permissions for anyone else.
 
     int fp = fileno(pv_file);
     fchmod(fp, 0600);
 
-    // Initialize the random state using randstate_init(), using the set seed.
-    randstate_init(random_seed);
-
     // Make the public and private keys using ss_make_pub() and ss_make_priv(), respectively.
     mpz_t p, q, n, pq, d;
     mpz_inits(p, q, n, pq, d, NULL);
 
-    ss_make_pub(p, q, n, min_bits, miller_rabin_iters);
+    // Pull p and q from the prime pool when one is given, falling back to live generation when it is empty.
+    if (pool_name != NULL && primepool_take(p, q, pool_name, min_bits)) {
+        // n = p^2 * q
+        mpz_mul(n, p, p);
+        mpz_mul(n, n, q);
+    } else {
+        ss_make_pub(p, q, n, min_bits, miller_rabin_iters);
+    }
     ss_make_priv(d, pq, p, q);
 
     // Get the current user’s name as a string.You will want to use getenv().
@@ -89,7 +159,8 @@ int main(int argc, char **argv) {
     username = getenv("USER");
 
     // Write the computed public and private key to their respective files.
-    ss_write_pub(n, username, pb_file);
+    // The public key records the block size the private modulus allows, so encrypt can pack more per block.
+    ss_write_pub(n, ss_block_size(pq), username, pb_file);
     ss_write_priv(pq, d, pv_file);
 
     // If verbose output is enabled print the following, each with a trailing newline, in order: username, the first large prime p, the second large prime q, the public key n, the private exponent d, the private modulus pq
@@ -107,6 +178,8 @@ int main(int argc, char **argv) {
         gmp_printf("d  (%u bits) = %Zd\n", dbits, d);
     }
 
+    write_profile(verbose_output, trace_name);
+
     // Close the public and private key files, clear the random state with randstate_clear(), and clear any mpz_t variables you may have used.
     fclose(pb_file);
     fclose(pv_file);
@@ -125,10 +198,14 @@ void h_option(void) {
            "\n"
            "OPTIONS\n"
            "   -h             Display program help and usage.\n"
-           "   -v             Display verbose program output.\n"
+           "   -v             Display verbose program output and keygen profile.\n"
            "   -b bits        Minimum bits needed for public key n (default: 256).\n"
            "   -i iterations  Miller-Rabin iterations for testing (default: 50).\n"
+           "   -e bits        Cap iterations at a 2^-bits error bound (default: off).\n"
            "   -n pbfile      Public key file (default: ss.pub).\n"
            "   -d pvfile      Private key file (default: ss.priv).\n"
-           "   -s seed        Random seed for testing.\n");
+           "   -s seed        Random seed for testing.\n"
+           "   -p poolfile    Take p and q from a prime pool, if it has any.\n"
+           "   -f count       Add count prime pairs to the pool (-p) and exit.\n"
+           "   -t tracefile   Write a Chrome trace of prime generation to tracefile.\n");
 }
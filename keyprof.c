@@ -0,0 +1,81 @@
+#include "keyprof.h"
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+
+keyprof_t keyprof;
+
+typedef struct {
+    const char *name;
+    double start, dur; // seconds since keyprof_enable()
+    uint64_t bits;
+    int64_t result;
+} event_t;
+
+static bool enabled = false;
+static bool tracing = false;
+static double origin = 0;
+static event_t *events = NULL;
+static size_t event_count = 0, event_cap = 0;
+
+double keyprof_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+void keyprof_enable(bool trace) {
+    enabled = true;
+    tracing = trace;
+    origin = keyprof_now();
+}
+
+bool keyprof_enabled(void) {
+    return enabled;
+}
+
+double keyprof_event(const char *name, double start, uint64_t bits, int64_t result) {
+    double now = keyprof_now();
+    if (tracing) {
+        if (event_count == event_cap) {
+            event_cap = event_cap ? 2 * event_cap : 1024;
+            events = (event_t *) realloc(events, event_cap * sizeof(event_t));
+        }
+        events[event_count++] = (event_t) { name, start - origin, now - start, bits, result };
+    }
+    return now - start;
+}
+
+void keyprof_print(FILE *outfile) {
+    fprintf(outfile,
+        "keygen: %" PRIu64 " ss_make_pub attempts, %.3f s\n"
+        "keygen: %" PRIu64 " candidates, %" PRIu64 " primes, %.3f s in make_prime\n"
+        "keygen: rejected %" PRIu64 " even or small, %" PRIu64 " by base 2, %" PRIu64
+        " by random witnesses\n"
+        "keygen: %" PRIu64 " Miller-Rabin rounds, %.3f s in is_prime (%.3f s base 2, %.3f s "
+        "random)\n",
+        keyprof.pub_attempts, keyprof.make_pub_time, keyprof.candidates, keyprof.primes,
+        keyprof.make_prime_time, keyprof.rejected_trivial, keyprof.rejected_base2,
+        keyprof.rejected_random, keyprof.mr_rounds, keyprof.is_prime_time, keyprof.base2_time,
+        keyprof.random_time);
+}
+
+void keyprof_write_trace(FILE *outfile) {
+    fprintf(outfile, "{\"traceEvents\":[\n");
+    for (size_t i = 0; i < event_count; i++) {
+        // trace-event times are in microseconds
+        fprintf(outfile,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"bits\":%" PRIu64 ",\"result\":%" PRId64 "}}%s\n",
+            events[i].name, events[i].start * 1e6, events[i].dur * 1e6, events[i].bits,
+            events[i].result, (i + 1 < event_count) ? "," : "");
+    }
+    fprintf(outfile, "],\"displayTimeUnit\":\"ms\"}\n");
+}
+
+void keyprof_clear(void) {
+    free(events);
+    events = NULL;
+    event_count = 0;
+    event_cap = 0;
+}
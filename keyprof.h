@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// Key generation profiling.
+//
+// make_prime(), is_prime() and ss_make_pub() count their work in keyprof
+// as they go. Once keyprof_enable() is called they also time themselves,
+// and with tracing on every call is kept as a Chrome trace event
+// (chrome://tracing, Perfetto) for keyprof_write_trace().
+//
+
+typedef struct {
+    uint64_t candidates; // random candidates drawn by make_prime()
+    uint64_t rejected_trivial; // candidates rejected as even or at most 3
+    uint64_t rejected_base2; // candidates rejected by the strong base-2 round
+    uint64_t rejected_random; // candidates rejected by a random witness round
+    uint64_t primes; // candidates accepted
+    uint64_t mr_rounds; // Miller-Rabin rounds run, base-2 rounds included
+    uint64_t pub_attempts; // trips round ss_make_pub()'s loop
+    double make_pub_time; // seconds in ss_make_pub()
+    double make_prime_time; // seconds in make_prime()
+    double is_prime_time; // seconds in is_prime()
+    double base2_time; // seconds in base-2 rounds
+    double random_time; // seconds in random witness rounds
+} keyprof_t;
+
+extern keyprof_t keyprof;
+
+//
+// Turns on timing, and the trace event log if trace is set.
+//
+void keyprof_enable(bool trace);
+
+//
+// Whether timing is on; instrumented code skips the clock when it is not.
+//
+bool keyprof_enabled(void);
+
+//
+// Seconds on a monotonic clock, for keyprof_event() and the timers above.
+//
+double keyprof_now(void);
+
+//
+// Logs a complete trace event that started at start and ends now, if tracing.
+// Returns the seconds since start.
+//
+// Requires:
+//  name: static string naming the span
+//  bits: size of the number worked on, or 0
+//  result: outcome recorded with the event (1 for a prime, for instance)
+//
+double keyprof_event(const char *name, double start, uint64_t bits, int64_t result);
+
+//
+// Prints the counters and times to outfile.
+//
+void keyprof_print(FILE *outfile);
+
+//
+// Writes the trace events logged so far as Chrome trace-event JSON.
+//
+void keyprof_write_trace(FILE *outfile);
+
+//
+// Frees the trace event log.
+//
+void keyprof_clear(void);
@@ -0,0 +1,240 @@
+#include "multi.h"
+#include "arena.h"
+#include "ss.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MULTI_BLOCKS 256 // blocks read and imported per round of parallel modexps
+
+// recipient threads, started once per file and handed one round at a time
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start; // signalled when a round is ready, or on quit
+    pthread_cond_t done; // signalled when the last thread finishes a round
+    uint64_t round; // number of the round ready to run
+    uint64_t pending; // threads still working on it
+    bool quit;
+} crew_t;
+
+// one recipient's share of a round: encrypt every imported block under n
+typedef struct {
+    crew_t *crew;
+    mpz_srcptr n;
+    mpz_t *m; // shared, only read
+    uint64_t blocks;
+    size_t line_max; // hex digits of n, plus the newline
+    char *lines; // blocks × line_max
+    size_t *lens;
+} recipient_t;
+
+static void *recipient_worker(void *arg) {
+    recipient_t *r = (recipient_t *) arg;
+    mpz_t c;
+    mpz_init(c);
+    for (uint64_t b = 0; b < r->blocks; b++) {
+        char *line = r->lines + b * r->line_max;
+        ss_encrypt(c, r->m[b], r->n);
+        mpz_get_str(line, 16, c);
+        size_t len = strlen(line);
+        line[len++] = '\n';
+        r->lens[b] = len;
+    }
+    mpz_clear(c);
+    return NULL;
+}
+
+static void *recipient_thread(void *arg) {
+    recipient_t *r = (recipient_t *) arg;
+    crew_t *crew = r->crew;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&crew->lock);
+    for (;;) {
+        while (crew->round == seen && !crew->quit) {
+            pthread_cond_wait(&crew->start, &crew->lock);
+        }
+        if (crew->quit) {
+            break;
+        }
+        seen = crew->round;
+        pthread_mutex_unlock(&crew->lock);
+        recipient_worker(r);
+        pthread_mutex_lock(&crew->lock);
+        if (--crew->pending == 0) {
+            pthread_cond_signal(&crew->done);
+        }
+    }
+    pthread_mutex_unlock(&crew->lock);
+    // hand back this thread's pooled chunks, if the pooled allocator is in use
+    arena_reset();
+    return NULL;
+}
+
+void multi_write_header(FILE *outfile, mpz_t *ns, uint64_t count) {
+    fprintf(outfile, "%s\n%" PRIu64 "\n", MULTI_MAGIC, count);
+    for (uint64_t i = 0; i < count; i++) {
+        gmp_fprintf(outfile, "%Zx\n", ns[i]);
+    }
+}
+
+bool multi_encrypt_file(
+    FILE *infile, FILE *outfile, mpz_t *ns, const uint64_t *blocks, uint64_t count) {
+    // the smallest block size is safe for every key
+    uint64_t k = UINT64_MAX;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t ki = ss_encrypt_block_size(ns[i], blocks[i]);
+        k = ki < k ? ki : k;
+    }
+    mpz_t m[MULTI_BLOCKS];
+    for (uint64_t b = 0; b < MULTI_BLOCKS; b++) {
+        mpz_init(m[b]);
+    }
+    crew_t crew = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        0, 0, false };
+    recipient_t *rs = (recipient_t *) calloc(count, sizeof(recipient_t));
+    pthread_t *threads = (pthread_t *) calloc(count, sizeof(pthread_t));
+    for (uint64_t i = 0; i < count; i++) {
+        rs[i].crew = &crew;
+        rs[i].n = ns[i];
+        rs[i].m = m;
+        rs[i].line_max = mpz_sizeinbase(ns[i], 16) + 2;
+        rs[i].lines = (char *) malloc(MULTI_BLOCKS * rs[i].line_max);
+        rs[i].lens = (size_t *) calloc(MULTI_BLOCKS, sizeof(size_t));
+    }
+    uint8_t *block = (uint8_t *) calloc(k, sizeof(uint8_t));
+    block[0] = 0xFF;
+    // one thread for each recipient but the first, which this thread takes
+    uint64_t started = 0;
+    for (uint64_t i = 1; i < count; i++) {
+        if (pthread_create(&threads[i], NULL, recipient_thread, &rs[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+
+    uint64_t j;
+    bool more = true;
+    while (more) {
+        // read and import up to MULTI_BLOCKS blocks, once for every recipient
+        uint64_t got = 0;
+        while (got < MULTI_BLOCKS && (j = fread(block + 1, sizeof(uint8_t), k - 1, infile)) > 0) {
+            mpz_import(m[got++], j + 1, 1, sizeof(uint8_t), 1, 0, block);
+        }
+        more = (got == MULTI_BLOCKS);
+        if (got == 0) {
+            break;
+        }
+        // fan the modexps out across the recipients, keeping the first for this thread
+        for (uint64_t i = 0; i < count; i++) {
+            rs[i].blocks = got;
+        }
+        pthread_mutex_lock(&crew.lock);
+        crew.round += 1;
+        crew.pending = started;
+        pthread_cond_broadcast(&crew.start);
+        pthread_mutex_unlock(&crew.lock);
+        recipient_worker(&rs[0]);
+        for (uint64_t i = started + 1; i < count; i++) {
+            // no thread to be had for these
+            recipient_worker(&rs[i]);
+        }
+        pthread_mutex_lock(&crew.lock);
+        while (crew.pending > 0) {
+            pthread_cond_wait(&crew.done, &crew.lock);
+        }
+        pthread_mutex_unlock(&crew.lock);
+        for (uint64_t b = 0; b < got; b++) {
+            for (uint64_t i = 0; i < count; i++) {
+                fwrite(rs[i].lines + b * rs[i].line_max, sizeof(char), rs[i].lens[b], outfile);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&crew.lock);
+    crew.quit = true;
+    pthread_cond_broadcast(&crew.start);
+    pthread_mutex_unlock(&crew.lock);
+    for (uint64_t i = 1; i <= started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        free(rs[i].lines);
+        free(rs[i].lens);
+    }
+    for (uint64_t b = 0; b < MULTI_BLOCKS; b++) {
+        mpz_clear(m[b]);
+    }
+    free(block);
+    free(threads);
+    free(rs);
+    return !ferror(infile) && !ferror(outfile);
+}
+
+bool multi_is_container(FILE *infile) {
+    int first = getc(infile);
+    if (first == EOF) {
+        return false;
+    }
+    ungetc(first, infile);
+    // ciphertext lines are all hex digits
+    return first == MULTI_MAGIC[0];
+}
+
+bool multi_find_section(FILE *infile, const mpz_t pq, uint64_t *index, uint64_t *count) {
+    char *line = NULL;
+    size_t cap = 0;
+    bool found = false;
+    mpz_t n;
+    mpz_init(n);
+    if (getline(&line, &cap, infile) == -1 || strcmp(line, MULTI_MAGIC "\n") != 0
+        || fscanf(infile, "%" SCNu64 "\n", count) != 1 || *count == 0 || *count > MULTI_MAX) {
+        free(line);
+        mpz_clear(n);
+        return false;
+    }
+    for (uint64_t i = 0; i < *count; i++) {
+        if (gmp_fscanf(infile, "%Zx\n", n) != 1) {
+            found = false;
+            break;
+        }
+        // n = p²q for the key that pq = pq belongs to
+        if (!found && mpz_sgn(n) > 0 && mpz_divisible_p(n, pq)) {
+            *index = i;
+            found = true;
+        }
+    }
+    free(line);
+    mpz_clear(n);
+    return found;
+}
+
+bool multi_decrypt_section(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq,
+    uint64_t index, uint64_t count, blockcache_t *cache) {
+    ss_decrypt_ctx ctx;
+    ss_decrypt_init(&ctx, d, pq, cache);
+    uint8_t *out = (uint8_t *) malloc(ctx.k);
+    size_t out_len;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    bool ok = true;
+    // every count-th line, starting at index, is ours
+    for (uint64_t i = 0; ok && (len = getline(&line, &cap, infile)) != -1; i++) {
+        if (i % count != index) {
+            continue;
+        }
+        out_len = ctx.k;
+        ok = ss_decrypt_update(&ctx, out, &out_len, (const uint8_t *) line, (size_t) len);
+        fwrite(out, sizeof(uint8_t), out_len, outfile);
+    }
+    if (ok) {
+        out_len = ctx.k;
+        ok = ss_decrypt_final(&ctx, out, &out_len);
+        fwrite(out, sizeof(uint8_t), out_len, outfile);
+    }
+    free(line);
+    free(out);
+    ss_decrypt_clear(&ctx);
+    return ok && !ferror(infile) && !ferror(outfile);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <gmp.h>
+#include "blockcache.h"
+
+//
+// Multi-recipient containers: one file encrypted to several public keys.
+//
+// The container starts with a header naming every recipient's public key,
+//
+//   ss-multi 1
+//   <recipient count>
+//   <n of each recipient, in hex, one per line>
+//
+// followed, for each block of plaintext, by one ciphertext line per
+// recipient in header order. All recipients share one block size, the
+// smallest of theirs, so each block is read and imported once and its
+// modexps for the different keys run in parallel. A private key finds its
+// own section by the recipient whose n = p²q is divisible by its pq.
+//
+
+#define MULTI_MAGIC "ss-multi 1"
+#define MULTI_MAX   64 // most recipients in one container
+
+//
+// Writes the container header naming every recipient.
+//
+// Requires:
+//  outfile: open and writable file stream
+//  ns: public keys of the recipients
+//  count: number of recipients, 1 to MULTI_MAX
+//
+void multi_write_header(FILE *outfile, mpz_t *ns, uint64_t count);
+
+//
+// Encrypt infile to every recipient, after multi_write_header().
+//
+// Provides:
+//  fills outfile with the interleaved ciphertext
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  ns: public keys of the recipients, only read
+//  blocks: block size recorded in each public key, or 0
+//  count: number of recipients, 1 to MULTI_MAX
+//
+// Returns false if reading infile or writing outfile failed.
+//
+bool multi_encrypt_file(
+    FILE *infile, FILE *outfile, mpz_t *ns, const uint64_t *blocks, uint64_t count);
+
+//
+// Whether the next byte of infile starts a container, leaving it unread.
+//
+bool multi_is_container(FILE *infile);
+
+//
+// Reads a container header and finds the section for a private key.
+//
+// Provides:
+//  index: position of this key among the recipients
+//  count: number of recipients
+//
+// Requires:
+//  infile: open and readable file stream at the start of a container
+//  pq: private modulus
+//
+// Returns false if the header is malformed or pq is not one of the recipients.
+//
+bool multi_find_section(FILE *infile, const mpz_t pq, uint64_t *index, uint64_t *count);
+
+//
+// Decrypt this key's section of a container, after multi_find_section().
+//
+// Provides:
+//  fills outfile with the unencrypted data
+//
+// Requires:
+//  infile: open and readable file stream, just past the header
+//  outfile: open and writable file stream
+//  d: private exponent
+//  pq: private modulus
+//  index, count: from multi_find_section()
+//  cache: block cache for this key, or NULL to decrypt every line
+//
+// Returns false if a line is malformed, or reading or writing failed.
+//
+bool multi_decrypt_section(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq,
+    uint64_t index, uint64_t count, blockcache_t *cache);
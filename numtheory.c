@@ -1,6 +1,8 @@
 #include "numtheory.h"
 #include "randstate.h"
+#include "keyprof.h"
 #include <gmp.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -65,6 +67,7 @@ void mod_inverse(mpz_t o, const mpz_t a, const mpz_t n) {
     if (mpz_cmp_si(r, 1) > 0) {
         mpz_set_ui(o, 0);
         // return no inverse
+        mpz_clears(q, r, r_prime, r2, t, t_prime, t2, q_mul_rp, t_mul_rp, r_sub, t_sub, NULL);
         return;
     }
     // if t < 0
@@ -102,80 +105,214 @@ void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n) {
     }
     // store computed v to d
     mpz_set(o, v);
-    mpz_clears(d2, n2, v, p, NULL);
+    mpz_clears(d2, n2, v, p, v_mul_p, p_mul_p, NULL);
+}
+
+// MONTGOMERY ARITHMETIC
+void mont_init(mont_ctx *ctx, const mpz_t n) {
+    mpz_inits(ctx->n, ctx->ninv, ctx->one, ctx->minus_one, ctx->t, ctx->u, NULL);
+    mpz_set(ctx->n, n);
+    // R = 2^bits > n
+    ctx->bits = mpz_sizeinbase(n, 2);
+    // ninv = -n^-1 mod R
+    mpz_setbit(ctx->u, ctx->bits);
+    mpz_invert(ctx->ninv, n, ctx->u);
+    mpz_sub(ctx->ninv, ctx->u, ctx->ninv);
+    // one = R mod n, minus_one = (n - 1) * R mod n = n - one
+    mpz_mod(ctx->one, ctx->u, n);
+    mpz_sub(ctx->minus_one, n, ctx->one);
+}
+
+void mont_clear(mont_ctx *ctx) {
+    mpz_clears(ctx->n, ctx->ninv, ctx->one, ctx->minus_one, ctx->t, ctx->u, NULL);
+}
+
+// REDC: o = t / R mod n, for 0 <= t < n * R (destroys ctx->t)
+static void mont_redc(mpz_t o, mont_ctx *ctx) {
+    // u = (t mod R) * ninv mod R
+    mpz_tdiv_r_2exp(ctx->u, ctx->t, ctx->bits);
+    mpz_mul(ctx->u, ctx->u, ctx->ninv);
+    mpz_tdiv_r_2exp(ctx->u, ctx->u, ctx->bits);
+    // o = (t + u * n) / R, exact division
+    mpz_addmul(ctx->t, ctx->u, ctx->n);
+    mpz_tdiv_q_2exp(o, ctx->t, ctx->bits);
+    if (mpz_cmp(o, ctx->n) >= 0) {
+        mpz_sub(o, o, ctx->n);
+    }
+}
+
+void mont_to(mpz_t o, const mpz_t a, mont_ctx *ctx) {
+    mpz_mul_2exp(ctx->t, a, ctx->bits);
+    mpz_mod(o, ctx->t, ctx->n);
+}
+
+void mont_from(mpz_t o, const mpz_t a, mont_ctx *ctx) {
+    mpz_set(ctx->t, a);
+    mont_redc(o, ctx);
+}
+
+void mont_mul(mpz_t o, const mpz_t a, const mpz_t b, mont_ctx *ctx) {
+    mpz_mul(ctx->t, a, b);
+    mont_redc(o, ctx);
+}
+
+void mont_pow(mpz_t o, const mpz_t a, const mpz_t d, mont_ctx *ctx) {
+    // left to right square and multiply
+    mpz_set(o, ctx->one);
+    for (uint64_t i = mpz_sizeinbase(d, 2); i-- > 0;) {
+        mont_mul(o, o, o, ctx);
+        if (mpz_tstbit(d, i)) {
+            mont_mul(o, o, a, ctx);
+        }
+    }
+}
+
+void mont_pow_window(mpz_t o, const mpz_t a, const mpz_t d, mont_ctx *ctx) {
+    // table[i] = a^i for every 4 bit window value
+    mpz_t table[16];
+    mpz_init_set(table[0], ctx->one);
+    for (int i = 1; i < 16; i++) {
+        mpz_init(table[i]);
+        mont_mul(table[i], table[i - 1], a, ctx);
+    }
+    mpz_set(o, ctx->one);
+    uint64_t windows = (mpz_sizeinbase(d, 2) + 3) / 4;
+    for (uint64_t w = windows; w-- > 0;) {
+        // four squarings, then one multiply by the window's table entry
+        unsigned bits = 0;
+        for (int b = 3; b >= 0; b--) {
+            mont_mul(o, o, o, ctx);
+            bits = (bits << 1) | (unsigned) mpz_tstbit(d, 4 * w + (uint64_t) b);
+        }
+        if (bits != 0) {
+            mont_mul(o, o, table[bits], ctx);
+        }
+    }
+    for (int i = 0; i < 16; i++) {
+        mpz_clear(table[i]);
+    }
 }
 
 // CHECK IF NUMBER IS PRIME
-bool is_prime(const mpz_t n, uint64_t iters) {
-    mpz_t r, s, n2, y, j, s_sub_1, n_sub_1, n_minus_1, n_sub_3, a, o, two;
-    mpz_inits(r, s, n2, y, j, s_sub_1, n_sub_1, n_minus_1, n_sub_3, a, o, two, NULL);
-    // edge cases for 0, 1, 2, 3
-    if ((mpz_cmp_ui(n, 2) == 0) || (mpz_cmp_ui(n, 3) == 0)) {
+
+// error bound in bits for random candidates, 0 means run every round
+static uint64_t prime_error_bits = 0;
+
+void set_prime_error_bound(uint64_t bits) {
+    prime_error_bits = bits;
+}
+
+// smallest number of random rounds t for which the Damgard-Landrock-Pomerance
+// bound on accepting a random k bit composite is below 2^-error_bits
+static uint64_t prime_rounds_for(uint64_t k, uint64_t error_bits, uint64_t iters) {
+    for (uint64_t t = 1; t < iters; t++) {
+        double log2_err;
+        if (t == 1 && k >= 2) {
+            // p(k, 1) < k^2 * 4^(2 - sqrt(k))
+            log2_err = 2.0 * log2((double) k) + 2.0 * (2.0 - sqrt((double) k));
+        } else if (t >= 3 && k >= 21 && t <= k / 9) {
+            // p(k, t) < k^(3/2) * 2^t * t^(-1/2) * 4^(2 - sqrt(t * k))
+            log2_err = 1.5 * log2((double) k) + (double) t - 0.5 * log2((double) t)
+                       + 2.0 * (2.0 - sqrt((double) (t * k)));
+        } else {
+            continue;
+        }
+        if (-log2_err >= (double) error_bits) {
+            return t;
+        }
+    }
+    return iters;
+}
+
+// one strong probable prime round for witness a: a^r, then square up to s - 1 times
+static bool mr_round(const mpz_t a, const mpz_t r, uint64_t s, mpz_t x, mpz_t y, mont_ctx *ctx) {
+    mont_to(x, a, ctx);
+    mont_pow(y, x, r, ctx);
+    if ((mpz_cmp(y, ctx->one) == 0) || (mpz_cmp(y, ctx->minus_one) == 0)) {
         return true;
     }
-    if ((mpz_cmp_ui(n, 1) == 0) || (mpz_cmp_ui(n, 0) == 0)) {
+    for (uint64_t j = 1; j < s; j++) {
+        // y = y^2, staying in the Montgomery domain
+        mont_mul(y, y, y, ctx);
+        if (mpz_cmp(y, ctx->minus_one) == 0) {
+            return true;
+        }
+        if (mpz_cmp(y, ctx->one) == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool is_prime(const mpz_t n, uint64_t iters) {
+    // edge cases for 0, 1, 2, 3 and even numbers
+    if (mpz_cmp_ui(n, 3) <= 0) {
+        keyprof.rejected_trivial += (mpz_cmp_ui(n, 2) < 0);
+        return mpz_cmp_ui(n, 2) >= 0;
+    }
+    if (mpz_even_p(n)) {
+        keyprof.rejected_trivial += 1;
         return false;
     }
-    // n
-    mpz_set(n2, n);
-    // n - 1 (temp)
-    mpz_sub_ui(n_sub_1, n2, 1);
-    // n - 1
-    mpz_sub_ui(n_minus_1, n2, 1);
-    // n - 3
-    mpz_sub_ui(n_sub_3, n2, 3);
-    // set r and s
-    mpz_set_ui(two, 2);
-    // write n − 1 = 2^s * r such that r is odd 
-    while (mpz_even_p(n_sub_1)) {
-        // n /= 2
-        mpz_fdiv_q_ui(n_sub_1, n_sub_1, 2);
-        // s+=1
-        mpz_add_ui(s, s, 1); // value of s
-    }
-    // r
-    mpz_set(r, n_sub_1);
-    // s - 1
-    mpz_sub_ui(s_sub_1, s, 1);
-    // loop
-    for (uint64_t i = 1; i < iters; i++) {
-        // choose random a ∈ {2,3,...,n−2} 
+    double start = keyprof_enabled() ? keyprof_now() : 0;
+    mpz_t r, n_sub_1, n_sub_3, a, x, y;
+    mpz_inits(r, n_sub_1, n_sub_3, a, x, y, NULL);
+    mpz_sub_ui(n_sub_1, n, 1);
+    mpz_sub_ui(n_sub_3, n, 3);
+    // write n − 1 = 2^s * r such that r is odd
+    uint64_t s = mpz_scan1(n_sub_1, 0);
+    mpz_tdiv_q_2exp(r, n_sub_1, s);
+    // n, 1 and n - 1 move into the Montgomery domain once per candidate
+    mont_ctx ctx;
+    mont_init(&ctx, n);
+    // strong base 2 test weeds out almost every composite cheaply
+    mpz_set_ui(a, 2);
+    double base2_start = keyprof_enabled() ? keyprof_now() : 0;
+    bool prime = mr_round(a, r, s, x, y, &ctx);
+    keyprof.mr_rounds += 1;
+    keyprof.rejected_base2 += !prime;
+    double random_start = keyprof_enabled() ? keyprof_now() : 0;
+    keyprof.base2_time += random_start - base2_start;
+    uint64_t rounds = iters;
+    if (prime && prime_error_bits > 0) {
+        // the loop below runs rounds - 1 random witnesses
+        uint64_t t = prime_rounds_for(mpz_sizeinbase(n, 2), prime_error_bits, iters);
+        rounds = (t + 1 < iters) ? t + 1 : iters;
+    }
+    for (uint64_t i = 1; prime && i < rounds; i++) {
+        // choose random a ∈ {2,3,...,n−2}
         mpz_urandomm(a, state, n_sub_3);
         mpz_add_ui(a, a, 2);
-        // y = pow_mod(a, r, n);
-        pow_mod(y, a, r, n);
-        // if loop
-        if ((mpz_cmp_ui(y, 1) != 0) && (mpz_cmp(y, n_minus_1) != 0)) {
-            mpz_set_ui(j, 1);
-            while ((mpz_cmp(j, s_sub_1) <= 0) && (mpz_cmp(y, n_minus_1) != 0)) {
-                // y = pow_mod(y, 2, n)
-                pow_mod(y, y, two, n);
-                // if y == 1: false
-                if (mpz_cmp_ui(y, 1) == 0) {
-                    mpz_clears(
-                        r, s, n2, y, j, s_sub_1, n_sub_1, n_minus_1, n_sub_3, a, o, two, NULL);
-                    return false;
-                }
-                mpz_add_ui(j, j, 1);
-            }
-            // if y != n - 1 : false
-            if (mpz_cmp(y, n_minus_1) != 0) {
-                mpz_clears(r, s, n2, y, j, s_sub_1, n_sub_1, n_minus_1, n_sub_3, a, o, two, NULL);
-                return false;
-            }
-        }
+        prime = mr_round(a, r, s, x, y, &ctx);
+        keyprof.mr_rounds += 1;
+        keyprof.rejected_random += !prime;
+    }
+    mont_clear(&ctx);
+    mpz_clears(r, n_sub_1, n_sub_3, a, x, y, NULL);
+    if (keyprof_enabled()) {
+        keyprof.random_time += keyprof_now() - random_start;
+        keyprof.is_prime_time += keyprof_event("is_prime", start, mpz_sizeinbase(n, 2), prime);
     }
-    mpz_clears(r, s, n2, y, j, s_sub_1, n_sub_1, n_minus_1, n_sub_3, a, o, two, NULL);
-    return true;
+    return prime;
 }
 
 // MAKE PRIME
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    // make sure generated number is prime
-    while (is_prime(p, iters) == false) {
+    double start = keyprof_enabled() ? keyprof_now() : 0;
+    uint64_t drawn = 0;
+    // always draw a fresh candidate, even if p already holds a prime
+    do {
         // generate random number
         mpz_urandomb(p, state, bits);
         // generated prime should be at least bits number of bits long
         mpz_setbit(p, bits);
+        drawn += 1;
+        // make sure generated number is prime
+    } while (is_prime(p, iters) == false);
+    keyprof.candidates += drawn;
+    keyprof.primes += 1;
+    if (keyprof_enabled()) {
+        // the event records how many candidates this prime took
+        keyprof.make_prime_time += keyprof_event("make_prime", start, bits, (int64_t) drawn);
     }
 }
@@ -13,4 +13,44 @@ void pow_mod(mpz_t o, const mpz_t a, const mpz_t d, const mpz_t n);
 
 bool is_prime(const mpz_t n, uint64_t iters);
 
+//
+// Caps the random Miller-Rabin rounds is_prime() runs on candidates that
+// already passed a strong base-2 test, so that the chance of accepting a
+// random composite stays below 2^-bits (Damgard-Landrock-Pomerance bound).
+// The cap never exceeds the caller's iters. 0 disables the cap (default).
+//
+void set_prime_error_bound(uint64_t bits);
+
+//
+// Montgomery context for repeated multiplication modulo an odd n.
+// Values in the Montgomery domain are stored as a * R mod n, R = 2^bits.
+//
+typedef struct {
+    mpz_t n; // odd modulus
+    mpz_t ninv; // -n^-1 mod R
+    mpz_t one; // Montgomery form of 1 (R mod n)
+    mpz_t minus_one; // Montgomery form of n - 1
+    mpz_t t, u; // scratch for products and reductions
+    uint64_t bits;
+} mont_ctx;
+
+void mont_init(mont_ctx *ctx, const mpz_t n);
+
+void mont_clear(mont_ctx *ctx);
+
+// o = a * R mod n
+void mont_to(mpz_t o, const mpz_t a, mont_ctx *ctx);
+
+// o = a / R mod n
+void mont_from(mpz_t o, const mpz_t a, mont_ctx *ctx);
+
+// o = a * b / R mod n, with a and b in the Montgomery domain
+void mont_mul(mpz_t o, const mpz_t a, const mpz_t b, mont_ctx *ctx);
+
+// o = a^d in the Montgomery domain; o must not alias a
+void mont_pow(mpz_t o, const mpz_t a, const mpz_t d, mont_ctx *ctx);
+
+// o = a^d in the Montgomery domain using 4 bit fixed windows; o must not alias a
+void mont_pow_window(mpz_t o, const mpz_t a, const mpz_t d, mont_ctx *ctx);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
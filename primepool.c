@@ -0,0 +1,188 @@
+#include "primepool.h"
+#include "ss.h"
+#include <fcntl.h>
+#include <gmp.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// open the pool file and take an exclusive lock on it
+static int pool_open(const char *path, int flags) {
+    for (;;) {
+        int fd = open(path, flags, 0600);
+        if (fd < 0) {
+            return -1;
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+            close(fd);
+            return -1;
+        }
+        // primepool_take() renames a new pool over the old one; if that happened while we
+        // waited for the lock, we hold a lock on a file no longer in the pool, so try again
+        struct stat held, named;
+        if (fstat(fd, &held) == 0 && stat(path, &named) == 0 && held.st_dev == named.st_dev
+            && held.st_ino == named.st_ino) {
+            // keep the pool private even if it was created by something else
+            fchmod(fd, 0600);
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+// write len bytes of buf to a new file that replaces path in one rename
+static bool pool_replace(const char *path, const char *buf, size_t len) {
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = (char *) malloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    bool ok = (fd >= 0);
+    for (size_t done = 0; ok && done < len;) {
+        ssize_t w = write(fd, buf + done, len - done);
+        ok = (w > 0);
+        done += ok ? (size_t) w : 0;
+    }
+    if (fd >= 0) {
+        ok = (fsync(fd) == 0) && ok;
+        ok = (close(fd) == 0) && ok;
+    }
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+// read the whole (locked) pool into a NUL terminated buffer
+static char *pool_slurp(int fd, size_t *len) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    char *buf = (char *) calloc((size_t) st.st_size + 1, sizeof(char));
+    if (buf == NULL) {
+        return NULL;
+    }
+    size_t got = 0;
+    while (got < (size_t) st.st_size) {
+        ssize_t r = pread(fd, buf + got, (size_t) st.st_size - got, (off_t) got);
+        if (r <= 0) {
+            break;
+        }
+        got += (size_t) r;
+    }
+    *len = got;
+    return buf;
+}
+
+// key size recorded at the start of a pool line
+static uint64_t line_bits(const char *line) {
+    return (uint64_t) strtoull(line, NULL, 10);
+}
+
+bool primepool_fill(const char *path, uint64_t nbits, uint64_t count, uint64_t iters) {
+    mpz_t p, q, n;
+    mpz_inits(p, q, n, NULL);
+    // generate the primes before locking so other keygens are not held up
+    char **lines = (char **) calloc(count, sizeof(char *));
+    for (uint64_t i = 0; i < count; i++) {
+        ss_make_pub(p, q, n, nbits, iters);
+        gmp_asprintf(&lines[i], "%" PRIu64 " %Zx %Zx\n", nbits, p, q);
+    }
+    mpz_clears(p, q, n, NULL);
+
+    bool ok = false;
+    int fd = pool_open(path, O_WRONLY | O_CREAT | O_APPEND);
+    if (fd >= 0) {
+        ok = true;
+        for (uint64_t i = 0; i < count; i++) {
+            size_t len = strlen(lines[i]);
+            if (write(fd, lines[i], len) != (ssize_t) len) {
+                ok = false;
+            }
+        }
+        ok = (fsync(fd) == 0) && ok;
+        close(fd);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        // the pool holds private primes, do not leave copies lying around
+        memset(lines[i], 0, strlen(lines[i]));
+        free(lines[i]);
+    }
+    free(lines);
+    return ok;
+}
+
+bool primepool_take(mpz_t p, mpz_t q, const char *path, uint64_t nbits) {
+    int fd = pool_open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    size_t len = 0;
+    char *buf = pool_slurp(fd, &len);
+    if (buf == NULL) {
+        close(fd);
+        return false;
+    }
+    // find the first pair generated for this key size
+    bool found = false;
+    char *line = buf;
+    char *end = buf;
+    while (line < buf + len) {
+        end = strchr(line, '\n');
+        end = (end == NULL) ? buf + len : end + 1;
+        if (line_bits(line) == nbits
+            && gmp_sscanf(line, "%*" SCNu64 " %Zx %Zx", p, q) == 2) {
+            found = true;
+            break;
+        }
+        line = end;
+    }
+    if (found) {
+        // single use: the pool without the pair replaces the old one before unlocking, so a
+        // failure leaves the old pool whole and the pair is not handed out
+        size_t tail = (size_t) (buf + len - end);
+        memmove(line, end, tail);
+        size_t new_len = (size_t) (line - buf) + tail;
+        if (!pool_replace(path, buf, new_len)) {
+            found = false;
+            mpz_set_ui(p, 0);
+            mpz_set_ui(q, 0);
+        }
+    }
+    memset(buf, 0, len);
+    free(buf);
+    close(fd);
+    return found;
+}
+
+uint64_t primepool_count(const char *path, uint64_t nbits) {
+    int fd = pool_open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    size_t len = 0;
+    char *buf = pool_slurp(fd, &len);
+    close(fd);
+    if (buf == NULL) {
+        return 0;
+    }
+    uint64_t count = 0;
+    for (char *line = buf; line < buf + len;) {
+        if (line_bits(line) == nbits) {
+            count += 1;
+        }
+        char *end = strchr(line, '\n');
+        line = (end == NULL) ? buf + len : end + 1;
+    }
+    memset(buf, 0, len);
+    free(buf);
+    return count;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdio.h>
+#include <gmp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//
+// A prime pool is a local file of pre-generated, Miller-Rabin verified
+// prime pairs (p, q) suitable for ss_make_pub(). Each line holds one pair:
+//
+//  nbits p q
+//
+// where nbits is the requested key size in decimal and p, q are hexstrings.
+// The file is created with 0600 permissions and every access holds an
+// exclusive flock() on it, so several keygen processes may share one pool.
+//
+
+//
+// Appends fresh prime pairs to a pool file.
+//
+// Provides:
+//  count new (p, q) pairs for nbits keys appended to the pool
+//  returns false if the pool could not be opened or locked
+//
+// Requires:
+//  path: pool file path (created if missing)
+//  nbits: minimum # of bits in n
+//  count: number of pairs to generate
+//  iters: iterations of Miller-Rabin to use for primality check
+//  randstate_init() to have been called
+//
+bool primepool_fill(const char *path, uint64_t nbits, uint64_t count, uint64_t iters);
+
+//
+// Removes one prime pair for nbits keys from a pool file.
+//
+// Provides:
+//  p: first prime
+//  q: second prime
+//  returns true if a pair was taken, false (with p and q zero) if none was
+//  available or the pool could not be rewritten without it
+//
+// Requires:
+//  path: pool file path
+//  nbits: minimum # of bits in n
+//  all mpz_t arguments to be initialized
+//
+bool primepool_take(mpz_t p, mpz_t q, const char *path, uint64_t nbits);
+
+//
+// Counts the prime pairs available for nbits keys in a pool file.
+//
+// Requires:
+//  path: pool file path
+//  nbits: minimum # of bits in n
+//
+uint64_t primepool_count(const char *path, uint64_t nbits);
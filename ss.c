@@ -2,10 +2,17 @@
 #include <gmp.h>
 #include "ss.h"
 #include "numtheory.h"
+#include "backend.h"
 #include "randstate.h"
+#include "keyprof.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+
+// bytes read from a FILE at a time by ss_encrypt_file() and ss_decrypt_file()
+#define SS_CHUNK 65536
 
 // received CSE 13S TA/tutor instruction in utilizing some gmp functions and general explanations on functions
 
@@ -34,7 +41,10 @@ void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
     p_bit = (random() % (nbits_lower)) + (nbits_lower);
     // Recall that n = p2 × q
     q_bit = nbits - (2 * p_bit);
+    double start = keyprof_enabled() ? keyprof_now() : 0;
+    uint64_t attempts = 0;
     do {
+        attempts += 1;
         // create primes p, q using make_prime()
         make_prime(p, p_bit, iters);
         make_prime(q, q_bit, iters);
@@ -52,6 +62,11 @@ void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters) {
     // check that p not div by q − 1 and q not div by p − 1, and log2(n) ≥ nbits.
     while (((mpz_cmp_ui(p_mod, 0) == 0) && (mpz_cmp_ui(q_mod, 0) == 0)
             && (mpz_sizeinbase(n, 2) >= nbits)));
+    keyprof.pub_attempts += attempts;
+    if (keyprof_enabled()) {
+        keyprof.make_pub_time += keyprof_event("ss_make_pub", start, nbits, (int64_t) attempts);
+    }
+    mpz_clears(p_power, p_sub_1, q_sub_1, n_bits, p_mod, q_mod, NULL);
 }
 
 //
@@ -87,19 +102,39 @@ void ss_make_priv(mpz_t d, mpz_t pq, const mpz_t p, const mpz_t q) {
     mpz_clears(n, p_sub_1, q_sub_1, p_mul_q, pq_gcd, lcm, NULL);
 }
 
+//
+// Computes the plaintext block size that is safe for a private modulus.
+// Every block m, including its 0xFF pad byte, satisfies m < 2^(8k) < pq.
+//
+// Provides:
+//  returns k = ⌊(log2(pq) − 1)/8⌋
+//
+// Requires:
+//  pq: private modulus
+//
+
+uint64_t ss_block_size(const mpz_t pq) {
+    return (mpz_sizeinbase(pq, 2) - 1) / 8;
+}
+
 //
 // Export SS public key to output stream
 //
 // Requires:
 //  n: public modulus/exponent
+//  block: ss_block_size() of the private modulus, or 0 to write version 1
 //  username: login name of keyholder ($USER)
 //  pbfile: open and writable file stream
 //
 
-void ss_write_pub(const mpz_t n, const char username[], FILE *pbfile) {
+void ss_write_pub(const mpz_t n, uint64_t block, const char username[], FILE *pbfile) {
     // write public ss key to file
     // hexstring: %Zx
-    gmp_fprintf(pbfile, "%Zx\n%s\n", n, username);
+    if (block == 0) {
+        gmp_fprintf(pbfile, "%Zx\n%s\n", n, username);
+        return;
+    }
+    gmp_fprintf(pbfile, "ss-pub %d\n%Zx\n%s\n%" PRIu64 "\n", SS_PUB_VERSION, n, username, block);
 }
 
 //
@@ -122,18 +157,52 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile) {
 //
 // Provides:
 //  n: public modulus
+//  block: recorded plaintext block size, 0 for version 1 keys
 //  username: $USER of the pubkey creator
 //
 // Requires:
 //  pbfile: open and readable file stream
-//  username: requires sufficient space
+//  username: requires SS_USERNAME_MAX bytes of space
 //  all mpz_t arguments to be initialized
 //
+// Returns false, with n set to 0, if pbfile does not hold a whole key of a
+// version this code knows.
 //
 
-void ss_read_pub(mpz_t n, char username[], FILE *pbfile) {
-    // read n and username from file
-    gmp_fscanf(pbfile, "%Zx\n%s\n", n, username);
+bool ss_read_pub(mpz_t n, uint64_t *block, char username[], FILE *pbfile) {
+    char *line = NULL;
+    size_t cap = 0;
+    int version = 1;
+    *block = 0;
+    username[0] = '\0';
+    // version 2 starts with a header line, version 1 starts with n; a later
+    // version's layout is unknown, so it is refused rather than misread
+    bool ok = getline(&line, &cap, pbfile) >= 0;
+    if (ok && sscanf(line, "ss-pub %d", &version) == 1) {
+        ok = version == SS_PUB_VERSION && getline(&line, &cap, pbfile) >= 0;
+    }
+    // read n and username from file; a corrupt n is not a key
+    ok = ok && mpz_set_str(n, line, 16) == 0 && mpz_sgn(n) > 0;
+    if (ok && getline(&line, &cap, pbfile) >= 0) {
+        line[strcspn(line, "\n")] = '\0';
+        snprintf(username, SS_USERNAME_MAX, "%s", line);
+    } else {
+        // only a version 1 key may stop after n
+        ok = ok && version == 1;
+    }
+    // the block size bound only exists in version 2
+    if (ok && version == 2) {
+        char *end = NULL;
+        ok = getline(&line, &cap, pbfile) >= 0;
+        *block = ok ? (uint64_t) strtoull(line, &end, 10) : 0;
+        ok = ok && end != line && (*end == '\n' || *end == '\0');
+    }
+    if (!ok) {
+        mpz_set_ui(n, 0);
+        *block = 0;
+    }
+    free(line);
+    return ok;
 }
 
 //
@@ -166,8 +235,8 @@ void ss_read_priv(mpz_t pq, mpz_t d, FILE *pvfile) {
 //
 
 void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
-    // m^n * mod n
-    pow_mod(c, m, n, n);
+    // m^n * mod n, using the modexp backend tuned for n's size
+    backend_pow_mod(c, m, n, n);
 }
 
 //
@@ -182,29 +251,204 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n) {
 //  n: public exponent and modulus
 
 void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
-    mpz_t n2, c, n_sqrt, curr_val, log_val, m;
-    mpz_inits(n2, n_sqrt, c, curr_val, log_val, m, NULL);
-    mpz_set(n2, n);
+    ss_encrypt_file_cached(infile, outfile, n, 0, NULL);
+}
+
+//
+// Encrypt an arbitrary file, reusing the ciphertext of repeated blocks
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  block: block size recorded in the public key, or 0 for ⌊(log2(√n) − 1)/8⌋
+//  cache: block cache for this key, or NULL to encrypt every block
+//
+// Returns false if reading infile or writing outfile failed.
+
+bool ss_encrypt_file_cached(
+    FILE *infile, FILE *outfile, const mpz_t n, uint64_t block, blockcache_t *cache) {
+    ss_encrypt_ctx ctx;
+    ss_encrypt_init(&ctx, n, block, cache);
+    uint8_t *in = (uint8_t *) malloc(SS_CHUNK);
+    size_t out_cap = ss_encrypt_max_output(&ctx, SS_CHUNK);
+    uint8_t *out = (uint8_t *) malloc(out_cap);
+    size_t got, out_len;
+    // feed infile through the stream in chunks; blocks come out exactly as if read k − 1 bytes at a time
+    while ((got = fread(in, sizeof(uint8_t), SS_CHUNK, infile)) > 0) {
+        out_len = out_cap;
+        ss_encrypt_update(&ctx, out, &out_len, in, got);
+        fwrite(out, sizeof(uint8_t), out_len, outfile);
+    }
+    out_len = out_cap;
+    ss_encrypt_final(&ctx, out, &out_len);
+    fwrite(out, sizeof(uint8_t), out_len, outfile);
+    free(out);
+    free(in);
+    ss_encrypt_clear(&ctx);
+    // a write error may only show up once the buffered output reaches the file
+    return fflush(outfile) == 0 && !ferror(infile) && !ferror(outfile);
+}
+
+//
+// Block size used to encrypt under a public key
+//
+// Requires:
+//  n: public exponent and modulus
+//  block: block size recorded in the public key, or 0
+//
 
+uint64_t ss_encrypt_block_size(const mpz_t n, uint64_t block) {
+    mpz_t root;
+    mpz_init(root);
     // Calculate the block size k. This should be k = ⌊ (log2(root n)− 1)/8 ⌋.
-    mpz_sqrt(n_sqrt, n2);
-    uint64_t k = ((mpz_sizeinbase(n_sqrt, 2) - 1) / 8);
+    mpz_sqrt(root, n);
+    uint64_t k = ((mpz_sizeinbase(root, 2) - 1) / 8);
+    mpz_clear(root);
+    // A key that records the bound from its private modulus allows bigger blocks.
+    // pq < n, so anything at or past n's size cannot be a real bound.
+    if (block > k && block < mpz_sizeinbase(n, 2) / 8) {
+        k = block;
+    }
+    return k;
+}
+
+//
+// Start an incremental encryption
+//
+// Requires:
+//  ctx: context to initialize
+//  n: public exponent and modulus, kept by reference until ss_encrypt_clear()
+//  block: block size recorded in the public key, or 0 for ⌊(log2(√n) − 1)/8⌋
+//  cache: block cache for this key, or NULL to encrypt every block
+//
+
+void ss_encrypt_init(ss_encrypt_ctx *ctx, const mpz_t n, uint64_t block, blockcache_t *cache) {
+    mpz_inits(ctx->m, ctx->c, NULL);
+    ctx->n = n;
+    ctx->k = ss_encrypt_block_size(n, block);
     // Dynamically allocate a uint8_t block array that can hold k bytes.
-    uint8_t *block_array = (uint8_t *) calloc(k, sizeof(uint8_t));
+    ctx->block = (uint8_t *) calloc(ctx->k, sizeof(uint8_t));
     // Set the zeroth byte of the block to 0xFF
-    block_array[0] = 0xFF;
-    // While there are still unprocessed bytes in infile: Read k − 1 bytes from infile, j = number of bytes read. Place read bytes into the allocated block starting from index 1.
-    uint64_t j;
-    while ((j = fread(block_array + 1, sizeof(uint8_t), k - 1, infile))) {
-        mpz_import(m, j + 1, 1, sizeof(uint8_t), 1, 0, block_array);
-        // Encrypt m with ss_encrypt()
-        ss_encrypt(c, m, n);
-        // write hexstring encrypted number and newline
-        gmp_fprintf(outfile, "%Zx\n", &c);
+    ctx->block[0] = 0xFF;
+    ctx->fill = 0;
+    // hexstring of c and a NUL
+    ctx->line_max = mpz_sizeinbase(n, 16);
+    ctx->line = (char *) calloc(ctx->line_max + 1, sizeof(char));
+    ctx->cache = cache;
+}
+
+//
+// Largest output ss_encrypt_update() can produce for in_len bytes of input,
+// whatever is buffered. ss_encrypt_final() needs ss_encrypt_max_output(ctx, 1).
+//
+
+size_t ss_encrypt_max_output(const ss_encrypt_ctx *ctx, size_t in_len) {
+    return (in_len + ctx->k - 2) / (ctx->k - 1) * (ctx->line_max + 1);
+}
+
+// encrypt the j bytes buffered in the block into one output line
+static size_t encrypt_block(ss_encrypt_ctx *ctx, uint8_t *out) {
+    uint64_t j = ctx->fill;
+    const uint8_t *hit;
+    size_t hit_len;
+    ctx->fill = 0;
+    // identical blocks encrypt to identical lines
+    if (ctx->cache != NULL && blockcache_lookup(ctx->cache, ctx->block, j + 1, &hit, &hit_len)) {
+        memcpy(out, hit, hit_len);
+        return hit_len;
+    }
+    mpz_import(ctx->m, j + 1, 1, sizeof(uint8_t), 1, 0, ctx->block);
+    // Encrypt m with ss_encrypt()
+    ss_encrypt(ctx->c, ctx->m, ctx->n);
+    // write hexstring encrypted number and newline
+    mpz_get_str(ctx->line, 16, ctx->c);
+    size_t len = strlen(ctx->line);
+    memcpy(out, ctx->line, len);
+    out[len++] = '\n';
+    if (ctx->cache != NULL) {
+        blockcache_insert(ctx->cache, ctx->block, j + 1, out, len);
     }
-    free(block_array);
-    block_array = NULL;
-    mpz_clears(n2, c, n_sqrt, curr_val, log_val, m, NULL);
+    return len;
+}
+
+//
+// Encrypt the next chunk of a stream
+//
+// Provides:
+//  out: one line for every block of k − 1 bytes completed by in
+//  out_len: number of bytes written to out
+//  returns false, writing nothing, if out is too small
+//
+// Requires:
+//  out_len: space in out, at least ss_encrypt_max_output(ctx, in_len)
+//  in: next in_len bytes of plaintext, of any size; a partial block is kept in ctx
+//
+
+bool ss_encrypt_update(
+    ss_encrypt_ctx *ctx, uint8_t *out, size_t *out_len, const uint8_t *in, size_t in_len) {
+    size_t cap = *out_len;
+    *out_len = 0;
+    if (cap < (ctx->fill + in_len) / (ctx->k - 1) * (ctx->line_max + 1)) {
+        return false;
+    }
+    while (in_len > 0) {
+        // Place bytes into the block starting from index 1, k − 1 bytes at a time.
+        size_t take = ctx->k - 1 - ctx->fill;
+        if (take > in_len) {
+            take = in_len;
+        }
+        memcpy(ctx->block + 1 + ctx->fill, in, take);
+        ctx->fill += take;
+        in += take;
+        in_len -= take;
+        if (ctx->fill == ctx->k - 1) {
+            *out_len += encrypt_block(ctx, out + *out_len);
+        }
+    }
+    return true;
+}
+
+//
+// Finish a stream, encrypting any partial block
+//
+// Provides:
+//  out: at most one line
+//  out_len: number of bytes written to out
+//  returns false, writing nothing, if out is too small
+//
+// Requires:
+//  out_len: space in out, at least ss_encrypt_max_output(ctx, 1)
+//
+// The context may be used for another stream afterwards.
+//
+
+bool ss_encrypt_final(ss_encrypt_ctx *ctx, uint8_t *out, size_t *out_len) {
+    size_t cap = *out_len;
+    *out_len = 0;
+    if (ctx->fill == 0) {
+        return true;
+    }
+    if (cap < ctx->line_max + 1) {
+        return false;
+    }
+    *out_len = encrypt_block(ctx, out);
+    return true;
+}
+
+//
+// Free the memory used by an incremental encryption
+//
+
+void ss_encrypt_clear(ss_encrypt_ctx *ctx) {
+    free(ctx->line);
+    free(ctx->block);
+    ctx->line = NULL;
+    ctx->block = NULL;
+    mpz_clears(ctx->m, ctx->c, NULL);
 }
 
 //
@@ -221,8 +465,8 @@ void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n) {
 //
 
 void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
-    // cd mod pq, using numtheory pow mod
-    pow_mod(m, c, d, pq);
+    // cd mod pq, using the constant time modexp backend tuned for pq's size (gmp-sec by default)
+    backend_pow_mod_secret(m, c, d, pq);
 }
 
 //
@@ -238,24 +482,228 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq) {
 //  pq: private modulus
 
 void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq) {
-    mpz_t pq2, c, n, m;
-    mpz_inits(c, n, m, NULL);
-    mpz_init_set(pq2, pq);
-    uint64_t j;
-    // k = ⌊(log2(pq) − 1)/8⌋
-    uint64_t k = ((mpz_sizeinbase(pq2, 2) - 1) / 8);
+    ss_decrypt_file_cached(infile, outfile, d, pq, NULL);
+}
+
+//
+// Decrypt a file, reusing the plaintext of repeated ciphertext lines
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  d: private exponent
+//  pq: private modulus
+//  cache: block cache for this key, or NULL to decrypt every line
+//
+// Returns false if infile holds a malformed line, or reading or writing failed.
+
+bool ss_decrypt_file_cached(
+    FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq, blockcache_t *cache) {
+    ss_decrypt_ctx ctx;
+    ss_decrypt_init(&ctx, d, pq, cache);
+    uint8_t *in = (uint8_t *) malloc(SS_CHUNK);
+    size_t out_cap = ctx.k;
+    uint8_t *out = (uint8_t *) malloc(out_cap);
+    size_t got, out_len;
+    bool ok = true;
+    // iterating over the lines in infile, in chunks that need not end on a line
+    while (ok && (got = fread(in, sizeof(uint8_t), SS_CHUNK, infile)) > 0) {
+        size_t need = ss_decrypt_max_output(&ctx, in, got);
+        if (need > out_cap) {
+            out_cap = need;
+            out = (uint8_t *) realloc(out, out_cap);
+        }
+        out_len = out_cap;
+        ok = ss_decrypt_update(&ctx, out, &out_len, in, got);
+        fwrite(out, sizeof(uint8_t), out_len, outfile);
+    }
+    if (ok) {
+        out_len = out_cap;
+        ok = ss_decrypt_final(&ctx, out, &out_len);
+        fwrite(out, sizeof(uint8_t), out_len, outfile);
+    }
+    free(out);
+    free(in);
+    ss_decrypt_clear(&ctx);
+    return fflush(outfile) == 0 && ok && !ferror(infile) && !ferror(outfile);
+}
+
+//
+// Start an incremental decryption
+//
+// Requires:
+//  ctx: context to initialize
+//  d: private exponent, kept by reference until ss_decrypt_clear()
+//  pq: private modulus, kept by reference until ss_decrypt_clear()
+//  cache: block cache for this key, or NULL to decrypt every line
+//
+
+void ss_decrypt_init(ss_decrypt_ctx *ctx, const mpz_t d, const mpz_t pq, blockcache_t *cache) {
+    mpz_inits(ctx->c, ctx->m, NULL);
+    ctx->d = d;
+    ctx->pq = pq;
+    // Blocks are at most k = ⌊(log2(pq) − 1)/8⌋ bytes, whether they were sized from n or from pq.
     // Dynamically allocate a uint8_t block array that can hold pq bytes.
-    uint8_t *block_array = (uint8_t *) calloc(k, sizeof(uint8_t));
-    // iterating over the lines in infile, Scan in a hexstring, saved to mpz_t c. 
-    while (gmp_fscanf(infile, "%Zx\n", c) != EOF) {
-        // decrypt c back into its original value m
-        ss_decrypt(m, c, d, pq);
-        // using mpz_export(), convert m back into bytes, storing them in the allocated block.
-        mpz_export(block_array, &j, 1, sizeof(uint8_t), 1, 0, m);
-        // Write out j − 1 bytes starting from index 1 of the block to outfile.
-        fwrite(block_array + 1, sizeof(uint8_t), j - 1, outfile);
+    ctx->k = mpz_sizeinbase(pq, 256);
+    ctx->block = (uint8_t *) calloc(ctx->k, sizeof(uint8_t));
+    // c < n = pq * p < pq^2, plus room for a carriage return and a NUL
+    ctx->line_max = 2 * mpz_sizeinbase(pq, 16) + 1;
+    ctx->line = (char *) calloc(ctx->line_max + 1, sizeof(char));
+    ctx->line_len = 0;
+    ctx->key = NULL;
+    ctx->key_cap = 0;
+    ctx->cache = cache;
+}
+
+//
+// Largest output ss_decrypt_update() can produce for the given input.
+// ss_decrypt_final() needs ss_decrypt_max_output(ctx, "\n", 1).
+//
+
+size_t ss_decrypt_max_output(const ss_decrypt_ctx *ctx, const uint8_t *in, size_t in_len) {
+    // every line completed by in gives at most k − 1 bytes
+    size_t lines = 0;
+    const uint8_t *end = in + in_len;
+    while ((in = (const uint8_t *) memchr(in, '\n', (size_t) (end - in))) != NULL) {
+        lines += 1;
+        in += 1;
+    }
+    return lines * (ctx->k - 1);
+}
+
+// decrypt the line buffered in ctx, returning false if it is not a hexstring
+static bool decrypt_line(ss_decrypt_ctx *ctx, uint8_t *out, size_t *out_len) {
+    size_t len = ctx->line_len;
+    ctx->line_len = 0;
+    // ignore trailing carriage returns and blank lines
+    while (len > 0 && (ctx->line[len - 1] == '\r' || ctx->line[len - 1] == ' ')) {
+        len -= 1;
+    }
+    if (len == 0) {
+        return true;
+    }
+    ctx->line[len] = '\0';
+    // Scan in a hexstring, saved to mpz_t c.
+    if (mpz_set_str(ctx->c, ctx->line, 16) != 0) {
+        return false;
+    }
+    const uint8_t *hit;
+    size_t hit_len, key_len = 0;
+    if (ctx->cache != NULL) {
+        // identical lines decrypt to identical bytes; c is reduced mod n, so it may be wider than pq
+        if (mpz_sizeinbase(ctx->c, 256) > ctx->key_cap) {
+            ctx->key_cap = mpz_sizeinbase(ctx->c, 256);
+            ctx->key = (uint8_t *) realloc(ctx->key, ctx->key_cap);
+        }
+        mpz_export(ctx->key, &key_len, 1, sizeof(uint8_t), 1, 0, ctx->c);
+        if (blockcache_lookup(ctx->cache, ctx->key, key_len, &hit, &hit_len)) {
+            memcpy(out + *out_len, hit, hit_len);
+            *out_len += hit_len;
+            return true;
+        }
+    }
+    // decrypt c back into its original value m
+    ss_decrypt(ctx->m, ctx->c, ctx->d, ctx->pq);
+    // using mpz_export(), convert m back into bytes, storing them in the allocated block.
+    size_t j;
+    mpz_export(ctx->block, &j, 1, sizeof(uint8_t), 1, 0, ctx->m);
+    if (j < 1) {
+        return false;
+    }
+    // Write out j − 1 bytes starting from index 1 of the block.
+    memcpy(out + *out_len, ctx->block + 1, j - 1);
+    *out_len += j - 1;
+    if (ctx->cache != NULL) {
+        blockcache_insert(ctx->cache, ctx->key, key_len, ctx->block + 1, j - 1);
+    }
+    return true;
+}
+
+//
+// Decrypt the next chunk of a stream
+//
+// Provides:
+//  out: the plaintext of every line completed by in
+//  out_len: number of bytes written to out
+//  returns false if out is too small (writing nothing) or a line is malformed
+//
+// Requires:
+//  out_len: space in out, at least ss_decrypt_max_output(ctx, in, in_len)
+//  in: next in_len bytes of ciphertext, of any size; a partial line is kept in ctx
+//
+
+bool ss_decrypt_update(
+    ss_decrypt_ctx *ctx, uint8_t *out, size_t *out_len, const uint8_t *in, size_t in_len) {
+    size_t cap = *out_len;
+    *out_len = 0;
+    if (cap < ss_decrypt_max_output(ctx, in, in_len)) {
+        return false;
+    }
+    const uint8_t *end = in + in_len;
+    while (in < end) {
+        const uint8_t *nl = (const uint8_t *) memchr(in, '\n', (size_t) (end - in));
+        const uint8_t *stop = (nl != NULL) ? nl : end;
+        size_t len = (size_t) (stop - in);
+        // carry the line over, possibly from an earlier chunk
+        if (ctx->line_len + len > ctx->line_max) {
+            return false;
+        }
+        memcpy(ctx->line + ctx->line_len, in, len);
+        ctx->line_len += len;
+        if (nl == NULL) {
+            break;
+        }
+        if (!decrypt_line(ctx, out, out_len)) {
+            return false;
+        }
+        in = nl + 1;
+    }
+    return true;
+}
+
+//
+// Finish a stream, decrypting a last line that has no newline
+//
+// Provides:
+//  out: the plaintext of that line
+//  out_len: number of bytes written to out
+//  returns false if out is too small (writing nothing) or the line is malformed
+//
+// Requires:
+//  out_len: space in out, at least ss_decrypt_max_output(ctx, "\n", 1)
+//
+// The context may be used for another stream afterwards.
+//
+
+bool ss_decrypt_final(ss_decrypt_ctx *ctx, uint8_t *out, size_t *out_len) {
+    size_t cap = *out_len;
+    *out_len = 0;
+    if (ctx->line_len == 0) {
+        return true;
+    }
+    if (cap < ctx->k - 1) {
+        return false;
+    }
+    return decrypt_line(ctx, out, out_len);
+}
+
+//
+// Free the memory used by an incremental decryption, zeroing plaintext
+//
+
+void ss_decrypt_clear(ss_decrypt_ctx *ctx) {
+    volatile uint8_t *p = ctx->block;
+    for (size_t i = 0; i < ctx->k; i++) {
+        p[i] = 0;
     }
-    free(block_array);
-    block_array = NULL;
-    mpz_clears(pq2, c, n, m, NULL);
+    free(ctx->block);
+    free(ctx->line);
+    free(ctx->key);
+    ctx->block = NULL;
+    ctx->line = NULL;
+    ctx->key = NULL;
+    mpz_clears(ctx->c, ctx->m, NULL);
 }
@@ -4,6 +4,7 @@
 #include <gmp.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include "blockcache.h"
 
 //
 // Generates the components for a new SS key.
@@ -34,15 +35,37 @@ void ss_make_pub(mpz_t p, mpz_t q, mpz_t n, uint64_t nbits, uint64_t iters);
 //
 void ss_make_priv(mpz_t d, mpz_t pq, const mpz_t p, const mpz_t q);
 
+// Current public key file version
+#define SS_PUB_VERSION 2
+
+// Space needed for a username read by ss_read_pub(), including its NUL
+#define SS_USERNAME_MAX 256
+
+//
+// Computes the plaintext block size that is safe for a private modulus.
+// Every block m, including its 0xFF pad byte, satisfies m < 2^(8k) < pq.
+//
+// Provides:
+//  returns k = ⌊(log2(pq) − 1)/8⌋
+//
+// Requires:
+//  pq: private modulus
+//
+uint64_t ss_block_size(const mpz_t pq);
+
 //
 // Export SS public key to output stream
 //
+// Version 2 files start with an "ss-pub 2" line and end with the block
+// size; version 1 files (n and username only) are still read.
+//
 // Requires:
 //  n: public modulus/exponent
+//  block: ss_block_size() of the private modulus, or 0 to write version 1
 //  username: login name of keyholder ($USER)
 //  pbfile: open and writable file stream
 //
-void ss_write_pub(const mpz_t n, const char username[], FILE *pbfile);
+void ss_write_pub(const mpz_t n, uint64_t block, const char username[], FILE *pbfile);
 
 //
 // Export SS private key to output stream
@@ -59,14 +82,19 @@ void ss_write_priv(const mpz_t pq, const mpz_t d, FILE *pvfile);
 //
 // Provides:
 //  n: public modulus
+//  block: recorded plaintext block size, 0 for version 1 keys
 //  username: $USER of the pubkey creator
 //
 // Requires:
 //  pbfile: open and readable file stream
-//  username: requires sufficient space
+//  username: requires SS_USERNAME_MAX bytes of space
 //  all mpz_t arguments to be initialized
 //
-void ss_read_pub(mpz_t n, char username[], FILE *pbfile);
+// Returns false, with n set to 0, if pbfile does not hold a whole key: n is
+// missing or not hex, a version 2 key lacks its username or block size, or
+// its header names any version but 2 (version 1 keys have no header).
+//
+bool ss_read_pub(mpz_t n, uint64_t *block, char username[], FILE *pbfile);
 
 //
 // Import SS private key from input stream
@@ -107,6 +135,24 @@ void ss_encrypt(mpz_t c, const mpz_t m, const mpz_t n);
 //
 void ss_encrypt_file(FILE *infile, FILE *outfile, const mpz_t n);
 
+//
+// Encrypt an arbitrary file, reusing the ciphertext of repeated blocks
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile
+//
+// Requires:
+//  infile: open and readable file stream
+//  outfile: open and writable file stream
+//  n: public exponent and modulus
+//  block: block size recorded in the public key, or 0 for ⌊(log2(√n) − 1)/8⌋
+//  cache: block cache for this key, or NULL to encrypt every block
+//
+// Returns false if reading infile or writing outfile failed.
+//
+bool ss_encrypt_file_cached(
+    FILE *infile, FILE *outfile, const mpz_t n, uint64_t block, blockcache_t *cache);
+
 //
 // Decrypt number c into number m
 //
@@ -134,3 +180,167 @@ void ss_decrypt(mpz_t m, const mpz_t c, const mpz_t d, const mpz_t pq);
 //  pq: private modulus
 //
 void ss_decrypt_file(FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq);
+
+//
+// Decrypt a file, reusing the plaintext of repeated ciphertext lines
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile
+//
+// Requires:
+//  infile: open and readable file stream to encrypted data
+//  outfile: open and writable file stream
+//  d: private exponent
+//  pq: private modulus
+//  cache: block cache for this key, or NULL to decrypt every line
+//
+// Returns false if infile holds a malformed line, or reading or writing failed.
+//
+bool ss_decrypt_file_cached(
+    FILE *infile, FILE *outfile, const mpz_t d, const mpz_t pq, blockcache_t *cache);
+
+//
+// Block size k used to encrypt under a public key: each block carries
+// k − 1 plaintext bytes behind a 0xFF pad byte.
+//
+// Requires:
+//  n: public exponent and modulus
+//  block: block size recorded in the public key, or 0
+//
+uint64_t ss_encrypt_block_size(const mpz_t n, uint64_t block);
+
+//
+// Incremental encryption, for data that arrives in pieces (sockets, memory
+// buffers). ss_encrypt_file() is a wrapper over these; feeding the same bytes
+// through init/update/final in chunks of any size gives the same output.
+//
+typedef struct {
+    mpz_srcptr n; // public key, not owned
+    mpz_t m, c;
+    uint64_t k; // block size, including the 0xFF pad byte
+    uint8_t *block; // block being filled, block[0] = 0xFF
+    uint64_t fill; // plaintext bytes buffered in block[1..]
+    char *line; // hexstring of c
+    size_t line_max; // hex digits of n
+    blockcache_t *cache;
+} ss_encrypt_ctx;
+
+//
+// Start an incremental encryption
+//
+// Requires:
+//  ctx: context to initialize
+//  n: public exponent and modulus, kept by reference until ss_encrypt_clear()
+//  block: block size recorded in the public key, or 0 for ⌊(log2(√n) − 1)/8⌋
+//  cache: block cache for this key, or NULL to encrypt every block
+//
+void ss_encrypt_init(ss_encrypt_ctx *ctx, const mpz_t n, uint64_t block, blockcache_t *cache);
+
+//
+// Largest output ss_encrypt_update() can produce for in_len bytes of input,
+// whatever is buffered. ss_encrypt_final() needs ss_encrypt_max_output(ctx, 1).
+//
+size_t ss_encrypt_max_output(const ss_encrypt_ctx *ctx, size_t in_len);
+
+//
+// Encrypt the next chunk of a stream
+//
+// Provides:
+//  out: one line for every block of k − 1 bytes completed by in
+//  out_len: number of bytes written to out
+//  returns false, writing nothing, if out is too small
+//
+// Requires:
+//  out_len: space in out, at least ss_encrypt_max_output(ctx, in_len)
+//  in: next in_len bytes of plaintext, of any size; a partial block is kept in ctx
+//
+bool ss_encrypt_update(
+    ss_encrypt_ctx *ctx, uint8_t *out, size_t *out_len, const uint8_t *in, size_t in_len);
+
+//
+// Finish a stream, encrypting any partial block
+//
+// Provides:
+//  out: at most one line
+//  out_len: number of bytes written to out
+//  returns false, writing nothing, if out is too small
+//
+// Requires:
+//  out_len: space in out, at least ss_encrypt_max_output(ctx, 1)
+//
+// The context may be used for another stream afterwards.
+//
+bool ss_encrypt_final(ss_encrypt_ctx *ctx, uint8_t *out, size_t *out_len);
+
+//
+// Free the memory used by an incremental encryption
+//
+void ss_encrypt_clear(ss_encrypt_ctx *ctx);
+
+//
+// Incremental decryption, the counterpart of the functions above.
+// ss_decrypt_file() is a wrapper over these.
+//
+typedef struct {
+    mpz_srcptr d, pq; // private key, not owned
+    mpz_t c, m;
+    uint64_t k; // bytes in pq; every line gives at most k − 1 bytes
+    uint8_t *block; // bytes of m
+    char *line; // ciphertext line being collected
+    size_t line_len, line_max;
+    uint8_t *key; // bytes of c, for the cache
+    size_t key_cap;
+    blockcache_t *cache;
+} ss_decrypt_ctx;
+
+//
+// Start an incremental decryption
+//
+// Requires:
+//  ctx: context to initialize
+//  d: private exponent, kept by reference until ss_decrypt_clear()
+//  pq: private modulus, kept by reference until ss_decrypt_clear()
+//  cache: block cache for this key, or NULL to decrypt every line
+//
+void ss_decrypt_init(ss_decrypt_ctx *ctx, const mpz_t d, const mpz_t pq, blockcache_t *cache);
+
+//
+// Largest output ss_decrypt_update() can produce for the given input.
+// ss_decrypt_final() needs ss_decrypt_max_output(ctx, "\n", 1).
+//
+size_t ss_decrypt_max_output(const ss_decrypt_ctx *ctx, const uint8_t *in, size_t in_len);
+
+//
+// Decrypt the next chunk of a stream
+//
+// Provides:
+//  out: the plaintext of every line completed by in
+//  out_len: number of bytes written to out
+//  returns false if out is too small (writing nothing) or a line is malformed
+//
+// Requires:
+//  out_len: space in out, at least ss_decrypt_max_output(ctx, in, in_len)
+//  in: next in_len bytes of ciphertext, of any size; a partial line is kept in ctx
+//
+bool ss_decrypt_update(
+    ss_decrypt_ctx *ctx, uint8_t *out, size_t *out_len, const uint8_t *in, size_t in_len);
+
+//
+// Finish a stream, decrypting a last line that has no newline
+//
+// Provides:
+//  out: the plaintext of that line
+//  out_len: number of bytes written to out
+//  returns false if out is too small (writing nothing) or the line is malformed
+//
+// Requires:
+//  out_len: space in out, at least ss_decrypt_max_output(ctx, "\n", 1)
+//
+// The context may be used for another stream afterwards.
+//
+bool ss_decrypt_final(ss_decrypt_ctx *ctx, uint8_t *out, size_t *out_len);
+
+//
+// Free the memory used by an incremental decryption, zeroing plaintext
+//
+void ss_decrypt_clear(ss_decrypt_ctx *ctx);
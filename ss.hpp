@@ -0,0 +1,328 @@
+#pragma once
+
+//
+// Header-only C++ layer over the SS library.
+//
+// PublicKey and PrivateKey own their mpz_t values and clear them on
+// destruction. Moving a key swaps the limb pointers, so no limbs are copied.
+// Encryptor and Decryptor take ownership of a key and wrap the incremental
+// ss_encrypt_ctx / ss_decrypt_ctx API, which sizes all of its scratch once.
+// Each call writes its output into the given span and returns the number of
+// bytes written; update()/final() stream a message in pieces.
+//
+// The output of Encryptor::encrypt() is the same text ss_encrypt_file()
+// writes, so it can be decrypted by Decryptor::decrypt() or ./decrypt.
+//
+// Requires C++20 (std::span).
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <gmp.h>
+
+extern "C" {
+#include "numtheory.h"
+#include "randstate.h"
+#include "ss.h"
+}
+
+namespace ss {
+
+class PublicKey {
+public:
+    PublicKey() {
+        mpz_init(n_);
+    }
+
+    // block: ss_block_size() of the private modulus, or 0 if unknown
+    explicit PublicKey(const mpz_t n, uint64_t block = 0)
+        : block_(block) {
+        mpz_init_set(n_, n);
+    }
+
+    PublicKey(const PublicKey &other)
+        : block_(other.block_) {
+        mpz_init_set(n_, other.n_);
+    }
+
+    PublicKey(PublicKey &&other) noexcept
+        : block_(other.block_) {
+        mpz_init(n_);
+        mpz_swap(n_, other.n_);
+    }
+
+    PublicKey &operator=(const PublicKey &other) {
+        mpz_set(n_, other.n_);
+        block_ = other.block_;
+        return *this;
+    }
+
+    PublicKey &operator=(PublicKey &&other) noexcept {
+        mpz_swap(n_, other.n_);
+        std::swap(block_, other.block_);
+        return *this;
+    }
+
+    ~PublicKey() {
+        mpz_clear(n_);
+    }
+
+    // Reads a key written by ss_write_pub(); username receives the key holder if given.
+    static PublicKey read(FILE *pbfile, std::string *username = nullptr) {
+        PublicKey key;
+        char user[SS_USERNAME_MAX] = "";
+        if (!ss_read_pub(key.n_, &key.block_, user, pbfile)) {
+            throw std::runtime_error("ss: unable to read public key");
+        }
+        if (username != nullptr) {
+            *username = user;
+        }
+        return key;
+    }
+
+    void write(FILE *pbfile, const std::string &username) const {
+        ss_write_pub(n_, block_, username.c_str(), pbfile);
+    }
+
+    const __mpz_struct *n() const {
+        return n_;
+    }
+
+    // Plaintext block size recorded in the key, 0 for version 1 keys.
+    uint64_t block() const {
+        return block_;
+    }
+
+private:
+    mpz_t n_;
+    uint64_t block_ = 0;
+};
+
+class PrivateKey {
+public:
+    PrivateKey() {
+        mpz_inits(pq_, d_, NULL);
+    }
+
+    PrivateKey(const mpz_t pq, const mpz_t d) {
+        mpz_init_set(pq_, pq);
+        mpz_init_set(d_, d);
+    }
+
+    PrivateKey(const PrivateKey &) = delete;
+    PrivateKey &operator=(const PrivateKey &) = delete;
+
+    PrivateKey(PrivateKey &&other) noexcept {
+        mpz_inits(pq_, d_, NULL);
+        mpz_swap(pq_, other.pq_);
+        mpz_swap(d_, other.d_);
+    }
+
+    PrivateKey &operator=(PrivateKey &&other) noexcept {
+        mpz_swap(pq_, other.pq_);
+        mpz_swap(d_, other.d_);
+        return *this;
+    }
+
+    ~PrivateKey() {
+        mpz_clears(pq_, d_, NULL);
+    }
+
+    // Reads a key written by ss_write_priv().
+    static PrivateKey read(FILE *pvfile) {
+        PrivateKey key;
+        ss_read_priv(key.pq_, key.d_, pvfile);
+        if (mpz_sgn(key.pq_) <= 0 || mpz_sgn(key.d_) <= 0) {
+            throw std::runtime_error("ss: unable to read private key");
+        }
+        return key;
+    }
+
+    void write(FILE *pvfile) const {
+        ss_write_priv(pq_, d_, pvfile);
+    }
+
+    const __mpz_struct *pq() const {
+        return pq_;
+    }
+
+    const __mpz_struct *d() const {
+        return d_;
+    }
+
+private:
+    mpz_t pq_, d_;
+};
+
+struct KeyPair {
+    PublicKey pub;
+    PrivateKey priv;
+};
+
+// Generates a new key pair. Requires randstate_init() to have been called.
+inline KeyPair generate(uint64_t nbits, uint64_t iters) {
+    mpz_t p, q, n, pq, d;
+    mpz_inits(p, q, n, pq, d, NULL);
+    ss_make_pub(p, q, n, nbits, iters);
+    ss_make_priv(d, pq, p, q);
+    KeyPair pair { PublicKey(n, ss_block_size(pq)), PrivateKey(pq, d) };
+    mpz_clears(p, q, n, pq, d, NULL);
+    return pair;
+}
+
+class Encryptor {
+public:
+    explicit Encryptor(PublicKey key, blockcache_t *cache = nullptr)
+        : key_(std::move(key)) {
+        // a block must hold the pad byte and at least one byte of plaintext
+        if (ss_encrypt_block_size(key_.n(), key_.block()) < 2) {
+            throw std::invalid_argument("ss: public key too small");
+        }
+        ss_encrypt_init(&ctx_, key_.n(), key_.block(), cache);
+    }
+
+    Encryptor(Encryptor &&other) noexcept
+        : key_(std::move(other.key_)), ctx_(other.ctx_), live_(other.live_) {
+        // the context's limbs and buffers now belong to this object
+        ctx_.n = key_.n();
+        other.live_ = false;
+    }
+
+    Encryptor(const Encryptor &) = delete;
+    Encryptor &operator=(const Encryptor &) = delete;
+    Encryptor &operator=(Encryptor &&) = delete;
+
+    ~Encryptor() {
+        if (live_) {
+            ss_encrypt_clear(&ctx_);
+        }
+    }
+
+    // Plaintext bytes carried by each ciphertext line.
+    size_t block_bytes() const {
+        return ctx_.k - 1;
+    }
+
+    // Largest output encrypt() or update() can produce for in_len bytes of input.
+    size_t max_output(size_t in_len) const {
+        return ss_encrypt_max_output(&ctx_, in_len == 0 ? 1 : in_len);
+    }
+
+    // Encrypts one whole message in into out; throws std::length_error if out is too small.
+    size_t encrypt(std::span<const uint8_t> in, std::span<uint8_t> out) {
+        size_t written = update(in, out);
+        return written + final(out.subspan(written));
+    }
+
+    // Encrypts the next piece of a stream, keeping any partial block.
+    size_t update(std::span<const uint8_t> in, std::span<uint8_t> out) {
+        size_t out_len = out.size();
+        if (!ss_encrypt_update(&ctx_, out.data(), &out_len, in.data(), in.size())) {
+            throw std::length_error("ss: output buffer too small");
+        }
+        return out_len;
+    }
+
+    // Ends a stream, encrypting any partial block.
+    size_t final(std::span<uint8_t> out) {
+        size_t out_len = out.size();
+        if (!ss_encrypt_final(&ctx_, out.data(), &out_len)) {
+            throw std::length_error("ss: output buffer too small");
+        }
+        return out_len;
+    }
+
+    const PublicKey &key() const {
+        return key_;
+    }
+
+private:
+    PublicKey key_;
+    ss_encrypt_ctx ctx_;
+    bool live_ = true;
+};
+
+class Decryptor {
+public:
+    explicit Decryptor(PrivateKey key, blockcache_t *cache = nullptr)
+        : key_(std::move(key)) {
+        ss_decrypt_init(&ctx_, key_.d(), key_.pq(), cache);
+    }
+
+    Decryptor(Decryptor &&other) noexcept
+        : key_(std::move(other.key_)), ctx_(other.ctx_), live_(other.live_) {
+        // the context's limbs and buffers now belong to this object
+        ctx_.d = key_.d();
+        ctx_.pq = key_.pq();
+        other.live_ = false;
+    }
+
+    Decryptor(const Decryptor &) = delete;
+    Decryptor &operator=(const Decryptor &) = delete;
+    Decryptor &operator=(Decryptor &&) = delete;
+
+    ~Decryptor() {
+        if (live_) {
+            ss_decrypt_clear(&ctx_);
+        }
+    }
+
+    // Largest output decrypt() can produce for in_len bytes of ciphertext.
+    size_t max_output(size_t in_len) const {
+        // every line carries at most k - 1 bytes and is at least two characters long
+        return (in_len / 2 + 1) * (ctx_.k - 1);
+    }
+
+    // Largest output update() can produce for this piece of ciphertext.
+    size_t max_output(std::span<const uint8_t> in) const {
+        return ss_decrypt_max_output(&ctx_, in.data(), in.size());
+    }
+
+    // Decrypts the ciphertext lines of one whole message in into out; throws
+    // std::length_error if out is too small and std::invalid_argument on a malformed line.
+    size_t decrypt(std::span<const uint8_t> in, std::span<uint8_t> out) {
+        size_t written = update(in, out);
+        return written + final(out.subspan(written));
+    }
+
+    // Decrypts the next piece of a stream, keeping any partial line.
+    size_t update(std::span<const uint8_t> in, std::span<uint8_t> out) {
+        if (out.size() < max_output(in)) {
+            throw std::length_error("ss: output buffer too small");
+        }
+        size_t out_len = out.size();
+        if (!ss_decrypt_update(&ctx_, out.data(), &out_len, in.data(), in.size())) {
+            throw std::invalid_argument("ss: malformed ciphertext line");
+        }
+        return out_len;
+    }
+
+    // Ends a stream, decrypting a last line without a newline.
+    size_t final(std::span<uint8_t> out) {
+        size_t out_len = out.size();
+        if (!ss_decrypt_final(&ctx_, out.data(), &out_len)) {
+            if (out.size() < ctx_.k - 1) {
+                throw std::length_error("ss: output buffer too small");
+            }
+            throw std::invalid_argument("ss: malformed ciphertext line");
+        }
+        return out_len;
+    }
+
+    const PrivateKey &key() const {
+        return key_;
+    }
+
+private:
+    PrivateKey key_;
+    ss_decrypt_ctx ctx_;
+    bool live_ = true;
+};
+
+} // namespace ss
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <gmp.h>
+#include "ss.h"
+#include "numtheory.h"
+#include "randstate.h"
+#include "backend.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#define OPTIONS "b:o:t:vh"
+
+void h_option(void);
+
+void usage(char *exec) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "   Benchmarks the modexp backends at each key size on this machine\n"
+        "   and writes the fastest ones to a tuning file for encrypt and decrypt.\n"
+        "\n"
+        "USAGE\n"
+        "   %s [OPTIONS]\n"
+        "\n"
+        "OPTIONS\n"
+        "   -h             Display program help and usage.\n"
+        "   -v             Display the timing of every backend.\n"
+        "   -b bits        Largest key size to tune, from 256 doubling (default: 4096).\n"
+        "   -t millis      Time spent on each backend per modulus (default: 200).\n"
+        "   -o tunefile    Tuning file (default: $SS_TUNE or ss.tune).\n",
+        exec);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+// time one backend on a^d mod n, returning seconds per modexp (or -1 if it gives a wrong answer)
+static double bench(const backend_t *backend, const mpz_t a, const mpz_t d, const mpz_t n,
+    const mpz_t expect, double budget) {
+    mpz_t o;
+    mpz_init(o);
+    backend->pow_mod(o, a, d, n);
+    if (mpz_cmp(o, expect) != 0) {
+        mpz_clear(o);
+        return -1;
+    }
+    uint64_t runs = 0;
+    double start = now();
+    double elapsed;
+    do {
+        backend->pow_mod(o, a, d, n);
+        runs += 1;
+        elapsed = now() - start;
+    } while (elapsed < budget || runs < 3);
+    mpz_clear(o);
+    return elapsed / (double) runs;
+}
+
+// pick and record the fastest backend for one modulus; a private exponent only
+// gets constant time backends, or its timing would leak it
+static void tune_modulus(const char *what, const mpz_t a, const mpz_t d, const mpz_t n,
+    bool secret, double budget, bool verbose) {
+    mpz_t expect;
+    mpz_init(expect);
+    mpz_powm(expect, a, d, n);
+    uint64_t bits = mpz_sizeinbase(n, 2);
+    const backend_t *best = NULL;
+    double best_time = 0;
+    for (size_t i = 0; i < backend_count; i++) {
+        if (secret && !backends[i].constant_time) {
+            continue;
+        }
+        double t = bench(&backends[i], a, d, n, expect, budget);
+        if (verbose) {
+            if (t < 0) {
+                printf("%-7s %5" PRIu64 " bits  %-12s wrong result\n", what, bits, backends[i].name);
+            } else {
+                printf("%-7s %5" PRIu64 " bits  %-12s %10.1f us\n", what, bits, backends[i].name,
+                    t * 1e6);
+            }
+        }
+        if (t >= 0 && (best == NULL || t < best_time)) {
+            best = &backends[i];
+            best_time = t;
+        }
+    }
+    if (best != NULL) {
+        if (secret) {
+            backend_set_secret(bits, best);
+        } else {
+            backend_set(bits, best);
+        }
+        printf("%-7s %5" PRIu64 " bits  -> %s\n", what, bits, best->name);
+    }
+    mpz_clear(expect);
+}
+
+int main(int argc, char **argv) {
+    bool verbose_output = false;
+    uint64_t max_bits = 4096;
+    uint64_t millis = 200;
+    char *tune_name = getenv("SS_TUNE");
+    if (tune_name == NULL) {
+        tune_name = BACKEND_TUNE_FILE;
+    }
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'v': verbose_output = true; break;
+        case 'b': max_bits = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 't': millis = (uint64_t) (strtoul(optarg, NULL, 10)); break;
+        case 'o': tune_name = optarg; break;
+        case 'h': h_option(); return 0;
+        default:
+            usage(argv[0]); /* Invalid options, show usage */
+            return EXIT_FAILURE;
+        }
+    }
+
+    randstate_init(time(NULL));
+    set_prime_error_bound(128);
+
+    mpz_t p, q, n, pq, d, m, c;
+    mpz_inits(p, q, n, pq, d, m, c, NULL);
+
+    // tune both moduli of a fresh key at every size: n for encrypt, pq for decrypt
+    for (uint64_t nbits = 256; nbits <= max_bits; nbits *= 2) {
+        ss_make_pub(p, q, n, nbits, 50);
+        ss_make_priv(d, pq, p, q);
+        mpz_urandomm(m, state, pq);
+        mpz_powm(c, m, n, n);
+        tune_modulus("encrypt", m, n, n, false, (double) millis / 1000, verbose_output);
+        tune_modulus("decrypt", c, d, pq, true, (double) millis / 1000, verbose_output);
+    }
+
+    FILE *tune_file = fopen(tune_name, "w");
+    if (tune_file == NULL) {
+        printf("%s: unable to open tuning file\n", tune_name);
+        mpz_clears(p, q, n, pq, d, m, c, NULL);
+        randstate_clear();
+        return EXIT_FAILURE;
+    }
+    backend_save(tune_file);
+    fclose(tune_file);
+
+    mpz_clears(p, q, n, pq, d, m, c, NULL);
+    randstate_clear();
+
+    return 0;
+}
+
+void h_option(void) {
+    printf("SYNOPSIS\n"
+           "   Benchmarks the modexp backends at each key size on this machine\n"
+           "   and writes the fastest ones to a tuning file for encrypt and decrypt.\n"
+           "\n"
+           "USAGE\n"
+           "   ./tune [OPTIONS]\n"
+           "\n"
+           "OPTIONS\n"
+           "   -h             Display program help and usage.\n"
+           "   -v             Display the timing of every backend.\n"
+           "   -b bits        Largest key size to tune, from 256 doubling (default: 4096).\n"
+           "   -t millis      Time spent on each backend per modulus (default: 200).\n"
+           "   -o tunefile    Tuning file (default: $SS_TUNE or ss.tune).\n");
+}
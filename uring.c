@@ -0,0 +1,422 @@
+#include "uring.h"
+#include "ss.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define DEPTH 8 // reads, and separately writes, kept in flight
+#define CHUNK (1 << 20) // bytes per read
+
+// user_data tags: the kind of request in the high bits, its slot in the low bits
+#define TAG_READ  (1ull << 32)
+#define TAG_WRITE (2ull << 32)
+
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned queued; // sqes not yet submitted
+    unsigned inflight; // requests submitted and not yet completed
+} ring_t;
+
+typedef struct {
+    uint8_t *buf;
+    uint64_t off; // file offset of buf[0]
+    size_t len; // bytes wanted
+    size_t done; // bytes transferred so far
+    uint64_t seq; // read order, for in order processing
+    bool busy; // a request is using the buffer
+    bool ready; // a read has all of its bytes
+} slot_t;
+
+typedef struct {
+    ring_t ring;
+    int infd, outfd;
+    bool fixed;
+    slot_t reads[DEPTH], writes[DEPTH];
+    size_t out_cap;
+    uint64_t in_off, in_end, out_off;
+    uint64_t next_read_seq;
+    bool failed;
+    uring_stats_t *stats;
+} pump_t;
+
+static bool ring_init(ring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        r->sq_len = r->cq_len = (r->sq_len > r->cq_len) ? r->sq_len : r->cq_len;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+        IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    r->cq_ptr = single ? r->sq_ptr
+                       : mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           r->fd, IORING_OFF_CQ_RING);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *) mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->cq_ptr == MAP_FAILED || r->sqes == MAP_FAILED) {
+        close(r->fd);
+        return false;
+    }
+    uint8_t *sq = (uint8_t *) r->sq_ptr, *cq = (uint8_t *) r->cq_ptr;
+    r->sq_head = (unsigned *) (sq + p.sq_off.head);
+    r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) (sq + p.sq_off.array);
+    r->cq_head = (unsigned *) (cq + p.cq_off.head);
+    r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    return true;
+}
+
+static void ring_clear(ring_t *r) {
+    munmap(r->sqes, r->sqes_len);
+    if (r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_len);
+    }
+    munmap(r->sq_ptr, r->sq_len);
+    close(r->fd);
+}
+
+// queue one read or write of a slot's remaining bytes
+static void queue_io(pump_t *pump, bool is_read, unsigned idx) {
+    ring_t *r = &pump->ring;
+    slot_t *slot = is_read ? &pump->reads[idx] : &pump->writes[idx];
+    unsigned tail = *r->sq_tail;
+    unsigned at = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[at];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = is_read ? pump->infd : pump->outfd;
+    sqe->addr = (uint64_t) (uintptr_t) (slot->buf + slot->done);
+    sqe->len = (uint32_t) (slot->len - slot->done);
+    sqe->off = slot->off + slot->done;
+    if (pump->fixed) {
+        sqe->opcode = is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+        // reads are registered first, then writes
+        sqe->buf_index = (uint16_t) (is_read ? idx : DEPTH + idx);
+    } else {
+        sqe->opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+    }
+    sqe->user_data = (is_read ? TAG_READ : TAG_WRITE) | idx;
+    r->sq_array[at] = at;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->queued += 1;
+    slot->busy = true;
+    if (is_read) {
+        pump->stats->reads += 1;
+    } else {
+        pump->stats->writes += 1;
+    }
+}
+
+// submit queued requests and wait for at least min_complete completions
+static bool ring_enter(pump_t *pump, unsigned min_complete) {
+    ring_t *r = &pump->ring;
+    unsigned submit = r->queued;
+    if (submit == 0 && min_complete == 0) {
+        return true;
+    }
+    r->inflight += submit;
+    r->queued = 0;
+    if (submit > 0) {
+        pump->stats->submits += 1;
+        pump->stats->depth_sum += r->inflight;
+        if (r->inflight > pump->stats->max_depth) {
+            pump->stats->max_depth = r->inflight;
+        }
+    }
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (syscall(__NR_io_uring_enter, r->fd, submit, min_complete, flags, NULL, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+        // the requests went in before the signal, only the wait is left
+        submit = 0;
+    }
+    return true;
+}
+
+// start the next read if there is file left and a free slot
+static void queue_reads(pump_t *pump) {
+    for (unsigned i = 0; i < DEPTH && pump->in_off < pump->in_end; i++) {
+        slot_t *slot = &pump->reads[i];
+        if (slot->busy || slot->ready) {
+            continue;
+        }
+        slot->off = pump->in_off;
+        slot->len = (pump->in_end - pump->in_off < CHUNK) ? pump->in_end - pump->in_off : CHUNK;
+        slot->done = 0;
+        slot->seq = pump->next_read_seq++;
+        pump->in_off += slot->len;
+        queue_io(pump, true, i);
+    }
+}
+
+// handle every completion the kernel has posted
+static void reap(pump_t *pump) {
+    ring_t *r = &pump->ring;
+    unsigned head = *r->cq_head;
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        bool is_read = (cqe->user_data & TAG_READ) != 0;
+        unsigned idx = (unsigned) (cqe->user_data & 0xffffffffu);
+        slot_t *slot = is_read ? &pump->reads[idx] : &pump->writes[idx];
+        int res = cqe->res;
+        head += 1;
+        r->inflight -= 1;
+        slot->busy = false;
+        if (res < 0 || (res == 0 && slot->done < slot->len)) {
+            // an error, or the input shrank under us
+            pump->failed = true;
+            slot->ready = is_read;
+            slot->len = slot->done;
+            continue;
+        }
+        slot->done += (size_t) res;
+        if (slot->done < slot->len) {
+            // short transfer, ask for the rest
+            queue_io(pump, is_read, idx);
+        } else if (is_read) {
+            slot->ready = true;
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static bool wait_one(pump_t *pump) {
+    if (!ring_enter(pump, 1)) {
+        pump->failed = true;
+        return false;
+    }
+    reap(pump);
+    return true;
+}
+
+// a write buffer with no request on it, waiting for one if needed
+static slot_t *free_write(pump_t *pump, unsigned *idx) {
+    for (;;) {
+        for (unsigned i = 0; i < DEPTH; i++) {
+            if (!pump->writes[i].busy) {
+                *idx = i;
+                return &pump->writes[i];
+            }
+        }
+        if (!wait_one(pump)) {
+            return NULL;
+        }
+    }
+}
+
+static void queue_write(pump_t *pump, unsigned idx, size_t len) {
+    slot_t *slot = &pump->writes[idx];
+    if (len == 0) {
+        return;
+    }
+    slot->off = pump->out_off;
+    slot->len = len;
+    slot->done = 0;
+    pump->out_off += len;
+    queue_io(pump, false, idx);
+}
+
+// how much of in a decrypt update can take without overflowing cap
+static size_t decrypt_fit(const ss_decrypt_ctx *ctx, const uint8_t *in, size_t len, size_t cap) {
+    size_t lines = cap / (ctx->k - 1);
+    const uint8_t *p = in, *end = in + len;
+    while (lines-- > 0) {
+        p = (const uint8_t *) memchr(p, '\n', (size_t) (end - p));
+        if (p == NULL) {
+            return len;
+        }
+        p += 1;
+    }
+    return (size_t) (p - in);
+}
+
+static uring_status_t pump_run(FILE *infile, FILE *outfile, ss_encrypt_ctx *ectx,
+    ss_decrypt_ctx *dctx, uring_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    int infd = fileno(infile), outfd = fileno(outfile);
+    struct stat in_st, out_st;
+    if (infd < 0 || outfd < 0 || fstat(infd, &in_st) != 0 || fstat(outfd, &out_st) != 0
+        || !S_ISREG(in_st.st_mode) || !S_ISREG(out_st.st_mode)) {
+        return URING_UNAVAILABLE;
+    }
+    // ftello counts bytes the caller has peeked at through stdio
+    off_t in_start = ftello(infile), out_start = lseek(outfd, 0, SEEK_CUR);
+    if (in_start < 0 || out_start < 0) {
+        return URING_UNAVAILABLE;
+    }
+    pump_t *pump = (pump_t *) calloc(1, sizeof(pump_t));
+    if (pump == NULL || !ring_init(&pump->ring, 4 * DEPTH)) {
+        free(pump);
+        return URING_UNAVAILABLE;
+    }
+    pump->infd = infd;
+    pump->outfd = outfd;
+    pump->stats = stats;
+    pump->in_off = (uint64_t) in_start;
+    pump->in_end = (uint64_t) in_st.st_size;
+    pump->out_off = (uint64_t) out_start;
+    // an encrypted chunk grows, a decrypted one is split to fit
+    pump->out_cap = (ectx != NULL) ? ss_encrypt_max_output(ectx, CHUNK) : CHUNK;
+    struct iovec iov[2 * DEPTH];
+    for (unsigned i = 0; i < DEPTH; i++) {
+        pump->reads[i].buf = (uint8_t *) malloc(CHUNK);
+        pump->writes[i].buf = (uint8_t *) malloc(pump->out_cap);
+        iov[i].iov_base = pump->reads[i].buf;
+        iov[i].iov_len = CHUNK;
+        iov[DEPTH + i].iov_base = pump->writes[i].buf;
+        iov[DEPTH + i].iov_len = pump->out_cap;
+    }
+    // registered buffers save the kernel pinning pages on every request; fine to go without
+    pump->fixed
+        = syscall(__NR_io_uring_register, pump->ring.fd, IORING_REGISTER_BUFFERS, iov, 2 * DEPTH)
+          == 0;
+    stats->fixed = pump->fixed;
+
+    uint64_t next_seq = 0;
+    queue_reads(pump);
+    while (!pump->failed && (next_seq < pump->next_read_seq || pump->in_off < pump->in_end)) {
+        // find the next read in file order
+        slot_t *slot = NULL;
+        for (unsigned i = 0; i < DEPTH; i++) {
+            if (pump->reads[i].ready && pump->reads[i].seq == next_seq) {
+                slot = &pump->reads[i];
+            }
+        }
+        if (slot == NULL) {
+            // submit anything queued, then wait for the kernel
+            wait_one(pump);
+            continue;
+        }
+        // hand the kernel the requests queued so far before the modexps start
+        ring_enter(pump, 0);
+        const uint8_t *in = slot->buf;
+        size_t len = slot->len;
+        while (len > 0 && !pump->failed) {
+            unsigned w;
+            slot_t *out = free_write(pump, &w);
+            if (out == NULL) {
+                break;
+            }
+            size_t piece = (ectx != NULL) ? len : decrypt_fit(dctx, in, len, pump->out_cap);
+            size_t out_len = pump->out_cap;
+            bool ok = (ectx != NULL) ? ss_encrypt_update(ectx, out->buf, &out_len, in, piece)
+                                     : ss_decrypt_update(dctx, out->buf, &out_len, in, piece);
+            if (!ok) {
+                pump->failed = true;
+                break;
+            }
+            queue_write(pump, w, out_len);
+            in += piece;
+            len -= piece;
+        }
+        slot->ready = false;
+        next_seq += 1;
+        queue_reads(pump);
+        ring_enter(pump, 0);
+    }
+    if (!pump->failed) {
+        // the last partial block or line
+        unsigned w;
+        slot_t *out = free_write(pump, &w);
+        if (out != NULL) {
+            size_t out_len = pump->out_cap;
+            bool ok = (ectx != NULL) ? ss_encrypt_final(ectx, out->buf, &out_len)
+                                     : ss_decrypt_final(dctx, out->buf, &out_len);
+            if (ok) {
+                queue_write(pump, w, out_len);
+            } else {
+                pump->failed = true;
+            }
+        }
+    }
+    // drain every request still in flight
+    ring_enter(pump, 0);
+    while (pump->ring.inflight > 0 || pump->ring.queued > 0) {
+        if (!wait_one(pump)) {
+            break;
+        }
+    }
+    // leave both files positioned as if they had been read and written in order
+    lseek(infd, (off_t) pump->in_end, SEEK_SET);
+    lseek(outfd, (off_t) pump->out_off, SEEK_SET);
+
+    bool failed = pump->failed;
+    for (unsigned i = 0; i < DEPTH; i++) {
+        free(pump->reads[i].buf);
+        free(pump->writes[i].buf);
+    }
+    ring_clear(&pump->ring);
+    free(pump);
+    return failed ? URING_ERROR : URING_OK;
+}
+
+uring_status_t uring_encrypt_file(
+    FILE *infile, FILE *outfile, ss_encrypt_ctx *ctx, uring_stats_t *stats) {
+    return pump_run(infile, outfile, ctx, NULL, stats);
+}
+
+uring_status_t uring_decrypt_file(
+    FILE *infile, FILE *outfile, ss_decrypt_ctx *ctx, uring_stats_t *stats) {
+    return pump_run(infile, outfile, NULL, ctx, stats);
+}
+
+#else
+
+uring_status_t uring_encrypt_file(
+    FILE *infile, FILE *outfile, ss_encrypt_ctx *ctx, uring_stats_t *stats) {
+    (void) infile, (void) outfile, (void) ctx;
+    memset(stats, 0, sizeof(*stats));
+    return URING_UNAVAILABLE;
+}
+
+uring_status_t uring_decrypt_file(
+    FILE *infile, FILE *outfile, ss_decrypt_ctx *ctx, uring_stats_t *stats) {
+    (void) infile, (void) outfile, (void) ctx;
+    memset(stats, 0, sizeof(*stats));
+    return URING_UNAVAILABLE;
+}
+
+#endif
+
+void uring_print_stats(const uring_stats_t *stats, FILE *outfile) {
+    double avg = stats->submits ? (double) stats->depth_sum / (double) stats->submits : 0;
+    fprintf(outfile,
+        "io_uring: %" PRIu64 " reads, %" PRIu64 " writes, queue depth %.1f avg %" PRIu64
+        " max, %s buffers\n",
+        stats->reads, stats->writes, avg, stats->max_depth,
+        stats->fixed ? "registered" : "unregistered");
+}
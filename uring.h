@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "ss.h"
+
+//
+// Asynchronous file I/O for encrypt and decrypt using Linux io_uring.
+//
+// Several large reads of infile and writes of outfile are kept in flight
+// (in registered buffers when the kernel allows it) while the blocks of the
+// current chunk are being exponentiated. Both files must be regular files;
+// anything else, or a kernel without io_uring, reports URING_UNAVAILABLE
+// before touching either file so the caller can fall back to stdio.
+//
+
+typedef enum {
+    URING_OK, // the whole file was processed
+    URING_UNAVAILABLE, // nothing was done, use the stdio path instead
+    URING_ERROR, // an I/O error or malformed input stopped processing part way
+} uring_status_t;
+
+typedef struct {
+    uint64_t reads; // read requests submitted
+    uint64_t writes; // write requests submitted
+    uint64_t max_depth; // most requests in flight at once
+    uint64_t depth_sum; // requests in flight, summed over every submission
+    uint64_t submits; // submissions to the kernel
+    bool fixed; // whether the buffers were registered with the kernel
+} uring_stats_t;
+
+//
+// Encrypt infile into outfile through an initialized incremental context.
+//
+// Provides:
+//  fills outfile with the encrypted contents of infile, as ss_encrypt_file() would
+//  stats: request and queue depth counters
+//
+// Requires:
+//  infile: open and readable file stream, positioned at the data
+//  outfile: open and writable file stream, nothing buffered in it
+//  ctx: from ss_encrypt_init(); the caller still clears it
+//
+uring_status_t uring_encrypt_file(
+    FILE *infile, FILE *outfile, ss_encrypt_ctx *ctx, uring_stats_t *stats);
+
+//
+// Decrypt infile into outfile through an initialized incremental context.
+//
+// Provides:
+//  fills outfile with the unencrypted data from infile, as ss_decrypt_file() would
+//  stats: request and queue depth counters
+//
+// Requires:
+//  infile: open and readable file stream, positioned at the data
+//  outfile: open and writable file stream, nothing buffered in it
+//  ctx: from ss_decrypt_init(); the caller still clears it
+//
+uring_status_t uring_decrypt_file(
+    FILE *infile, FILE *outfile, ss_decrypt_ctx *ctx, uring_stats_t *stats);
+
+//
+// Prints the counters in stats to outfile.
+//
+void uring_print_stats(const uring_stats_t *stats, FILE *outfile);